@@ -211,7 +211,11 @@ architecture vhdl_rtl of ethernet_data_block is
   signal ifm_rdusedw     : in_fifo_usedw_array(0 to N_IN_FIFOS-1);
   signal ifm_curr_fifo   : std_logic_vector(0 to f_num_bits(N_IN_FIFOS)-1);
   signal header_len      : std_logic_vector(8 downto 0);
-  constant app_header    : word                           := X"00_12_34_56";
+  --Application header: FIFO index (31:24) and a per-FIFO frame counter (23:0),
+  --so the host can spot lost, duplicated and reordered frames
+  type frame_count_array is array (0 to NFIFOS-1) of unsigned(23 downto 0);
+  signal frame_counts    : frame_count_array              := (others => (others => '0'));
+  signal app_header      : word;
   signal source_port     : std_logic_vector(15 downto 0)  := X"00_10";
   signal dest_port       : std_logic_vector(15 downto 0)  := X"00_11";
 
@@ -230,6 +234,23 @@ begin
   dest_port(ifm_curr_fifo'length-1 downto 0) <= ifm_curr_fifo;
   dest_port(15 downto ifm_curr_fifo'length)  <= base_udp_port(15 downto ifm_curr_fifo'length);
 
+  app_header <= std_logic_vector(resize(unsigned(ifm_curr_fifo), 8)) &
+                std_logic_vector(frame_counts(to_integer(unsigned(ifm_curr_fifo))));
+
+  --!Counts the frames sent from each FIFO. The header generator has already
+  --!sent the application header when it signals header_done.
+  frame_counter : process (clock, reset)
+  begin
+    if (reset = '1') then
+      frame_counts <= (others => (others => '0'));
+    elsif rising_edge(clock) then
+      if (header_done = '1') then
+        frame_counts(to_integer(unsigned(ifm_curr_fifo))) <=
+          frame_counts(to_integer(unsigned(ifm_curr_fifo)))+1;
+      end if;
+    end if;
+  end process frame_counter;
+
 
   -----------------------------------------------------------------------------
   -- Entity Instantiations
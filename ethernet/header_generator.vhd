@@ -117,6 +117,8 @@ architecture rtl of header_generator is
   -- Internal Signals
   -----------------------------------------------------------------------------
   signal header_len_sig      : std_logic_vector(header_len'length-1 downto 0);
+  --!Length of the application header in words (0 if disabled)
+  signal app_header_len      : natural range 0 to 1;
   signal payload_octets      : std_logic_vector(15 downto 0);
   signal source_mac_addr_sig : std_logic_vector(47 downto 0);
   signal dest_mac_addr_sig   : std_logic_vector(47 downto 0);
@@ -172,10 +174,12 @@ begin
   app_header_sig      <= app_header;
   ether_type_sig      <= ether_type;
   protocol_sig        <= protocol;
-  --Note: this is in words
-  header_len_sig      <= std_logic_vector(to_unsigned(7, header_len'length)) when (config(1)='1' and config(2)='1') else
-                         std_logic_vector(to_unsigned(5, header_len'length)) when (config(1)='1' and config(2)='0') else
-                         std_logic_vector(to_unsigned(2, header_len'length)) when (config(1)='0' and config(2)='1') else
+  app_header_len      <= 1 when config(3) = '1' else 0;
+  --Note: this is in words. The application header word is part of the IP/UDP
+  --payload, so it counts towards both lengths.
+  header_len_sig      <= std_logic_vector(to_unsigned(7+app_header_len, header_len'length)) when (config(1)='1' and config(2)='1') else
+                         std_logic_vector(to_unsigned(5+app_header_len, header_len'length)) when (config(1)='1' and config(2)='0') else
+                         std_logic_vector(to_unsigned(2+app_header_len, header_len'length)) when (config(1)='0' and config(2)='1') else
                          std_logic_vector(to_unsigned(0, header_len'length)) when (config(1)='0' and config(2)='0') else
                          (others => '0');
                          
@@ -300,7 +304,7 @@ begin
 
         when UDP1 =>
           --Length in bytes followed by (unused) checksum
-          header_data  <= std_logic_vector(resize(unsigned(payload_len)+to_unsigned(2, payload_len'length), 14))& "00" & X"00_00";
+          header_data  <= std_logic_vector(resize(unsigned(payload_len)+to_unsigned(2+app_header_len, payload_len'length), 14))& "00" & X"00_00";
           header_valid <= '1';
           nstate := f_next_state(next_state, config);
           next_state   <= nstate;
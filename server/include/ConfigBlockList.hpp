@@ -4,6 +4,11 @@
 #include <vector>
 #include <string>
 
+//Number of ADC data FIFOs of each Ethernet interface (the last of the N_IN_FIFOS=5 FIFOs is the loopback)
+#define ENET_DATA_FIFOS 4
+//FIFO (and UDP port offset) of the loopback, which sends back the words received on that port (UDP_PORT_LOOPBACKS in eth_common.vhd)
+#define ENET_LOOPBACK_FIFO 4
+
 class ConfigBlockList {
 public:
 	ConfigBlockList();
@@ -14,6 +19,8 @@ public:
 	std::vector<uint32_t> getConfigMessage();
 	bool write_all;
 	ConfigRegisterBlock& getBlock(std::string name);
+	ConfigRegisterBlock* getEnetBlock(int port);
+	std::vector<int> getDataPorts(std::vector<std::string> block_names);
 };
 
 #endif //CONFIG_BLOCK_LIST_HPP
@@ -0,0 +1,50 @@
+#ifndef COUNTER_CHECKER_HPP
+#define COUNTER_CHECKER_HPP
+
+#include <cstdint>
+#include <ostream>
+#include "StatsSnapshot.hpp"
+
+//Continuity of a counter stream (see CounterChecker)
+struct counter_stats_t {
+  counter_stats_t() : words(0), errors(0), skipped_words(0), host_gaps(0), first_error_offset(-1), first_expected(0), first_received(0) {};
+  //Words checked
+  long words;
+  //Breaks in the count the host can't explain: words the board lost (e.g. a FIFO overflow) or corrupted
+  long errors;
+  //Words missing at those breaks (forward jumps only)
+  long skipped_words;
+  //Breaks at frames the host knows it lost (sequence gaps), which are not errors of the board
+  long host_gaps;
+  //Word offset of the first error in the stream, with the count expected there and the word received (-1 if no error)
+  long first_error_offset;
+  uint32_t first_expected;
+  uint32_t first_received;
+};
+
+/*
+  Checks the data of one FIFO running the firmware's test counter (ENET_CounterEnable), which sends an incrementing 32-bit count, one word per write, in network byte order.
+  Words are compared four at a time against the expected counts with SSE2 where available. After a break the count resynchronises on the word received, so one lost block is one error.
+*/
+class CounterChecker {
+public:
+  CounterChecker();
+  //Checks nwords words of received data. host_gap says frames were lost on the way to the host right before this data, so a break at its first word is not counted as an error.
+  void check(const uint32_t *words, int nwords, bool host_gap=false);
+  //Counters as of the last data checked. May be called from any thread.
+  counter_stats_t getStats() const {return published.read();};
+  void report(std::ostream &out) const;
+private:
+  //Checks words start to end-1 one at a time, offset being the stream offset of words[0]
+  void checkScalar(const uint32_t *words, int start, int end, long offset, bool host_gap);
+  void recordBreak(uint32_t received, long offset, bool host_gap);
+  CounterChecker(const CounterChecker&);
+  CounterChecker& operator=(const CounterChecker&);
+  bool seen;
+  uint32_t next;
+  counter_stats_t stats;
+  //Copy of stats for other threads, published after every check
+  StatsSnapshot<counter_stats_t> published;
+};
+
+#endif //COUNTER_CHECKER_HPP
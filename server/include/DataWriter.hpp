@@ -0,0 +1,46 @@
+#ifndef DATA_WRITER_HPP
+#define DATA_WRITER_HPP
+
+#include <string>
+#include <fstream>
+#include <cstdint>
+
+#ifdef CFITSIO_INSTALLED
+#include "fitsio.h"
+#endif //CFITSIO_INSTALLED
+
+//Swaps byte ordering (little endian to big endian or vice versa)
+void swapBufferBytes(uint32_t *buffer, int nwords);
+
+/*
+  Output sink for the asynchronous receive threads. The output format is picked from the file name when the writer is opened:
+  If CFITSIO is installed and the name contains ".fits", data is written to a .fits image. If CFITSIO is not installed, attempting to write a .fits file will silently fail.
+  If the name contains ".txt", data is written as text (one hex word per line).
+  Otherwise, data is written as binary. The first two words of the binary file will contain the NCOLS and NROWS parameters.
+*/
+class DataWriter {
+public:
+  DataWriter();
+  ~DataWriter();
+  void open(std::string fname, int nrows, int ncols);
+  //Writes nbytes of raw packet data. Note the buffer may be byte swapped in place.
+  void write(char *buffer, int nbytes);
+  void close();
+  //Raw binary output can also be written directly to the file (see tell())
+  bool isBinary() {return outfile.is_open() && !write_text;};
+  //Flushes the output and returns the current end of the file
+  long tell();
+private:
+  bool write_fits;
+  bool write_text;
+  bool is_open;
+  std::ofstream outfile;
+#ifdef CFITSIO_INSTALLED
+  fitsfile *fFile;
+  int fstatus;
+  LONGLONG curr_pix;
+  LONGLONG pix_to_read;
+#endif //CFITSIO_INSTALLED
+};
+
+#endif //DATA_WRITER_HPP
@@ -0,0 +1,45 @@
+#ifndef LOG_HISTOGRAM_HPP
+#define LOG_HISTOGRAM_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+//Bucket i holds the values from 2^(i-1) up to 2^i-1 (bucket 0 holds zeros), enough for any 64-bit value
+#define LOG_HISTOGRAM_BUCKETS 65
+
+//Copy of the contents of a LogHistogram
+struct histogram_t {
+  histogram_t();
+  uint64_t buckets[LOG_HISTOGRAM_BUCKETS];
+  uint64_t count;
+  uint64_t total;
+  uint64_t max;
+  double mean() const {return count > 0 ? double(total)/count : 0;};
+  //Upper edge of the bucket holding the given fraction (0 to 1) of the values, i.e. within a factor of two of the actual percentile
+  uint64_t percentile(double fraction) const;
+  //Prints the summary and the non-empty buckets, with values divided by scale (e.g. 1000 to print nanoseconds as microseconds)
+  void report(std::ostream &out, std::string unit, double scale=1) const;
+};
+
+/*
+  Histogram with power-of-two buckets, for timings that span many orders of magnitude (e.g. packet inter-arrival gaps, from a few hundred nanoseconds in a burst to seconds between images).
+  Lock-free: one thread adds values, any thread can take a snapshot at any time. A snapshot taken while values are being added may be off by the values in flight.
+*/
+class LogHistogram {
+public:
+  LogHistogram();
+  //Adds a value. Only one thread may add values.
+  void add(uint64_t value);
+  histogram_t snapshot() const;
+private:
+  LogHistogram(const LogHistogram&);
+  LogHistogram& operator=(const LogHistogram&);
+  std::atomic<uint64_t> buckets[LOG_HISTOGRAM_BUCKETS];
+  std::atomic<uint64_t> count;
+  std::atomic<uint64_t> total;
+  std::atomic<uint64_t> max;
+};
+
+#endif //LOG_HISTOGRAM_HPP
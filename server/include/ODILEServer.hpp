@@ -3,12 +3,98 @@
 
 #include "udp_client_server.h"
 #include "ConfigBlockList.hpp"
+#include "PacketRing.hpp"
+#include "StatsSnapshot.hpp"
+#include "DataWriter.hpp"
+#include "SequenceTracker.hpp"
+#include "CounterChecker.hpp"
+#include "StreamMerger.hpp"
+#include "ThreadPolicy.hpp"
+#include "LogHistogram.hpp"
+#include "SourceTable.hpp"
+#include "TokenBucket.hpp"
 #include <string>
+#include <map>
+#include <deque>
 #include <pthread.h>
 
 #define NULL_IPADDRESS "0.0.0.0"
 #define COMMAND_PORT 0x3000
 #define FIRMWARE_PORT 0x4000
+//Commands queueCommand() keeps in flight by default (the board queues the commands it has to reply to in a 16-deep FIFO, see command_response_generator.vhd)
+#define COMMAND_WINDOW 8
+#define SEQ_SERIAL_PORT 0x1999
+//Path MTU sendData() splits payloads to, unless setMTU() says otherwise
+#define DEFAULT_MTU 1500
+//IPv4 and UDP header bytes in each datagram
+#define IP_UDP_HEADER_BYTES 28
+#define BUFFSIZE 2048
+//Largest datagram the receive buffers are sized for (a 9000-byte jumbo frame holds 8972 bytes of UDP payload)
+#define MAX_DATAGRAM_BYTES 9000
+//Receive buffer size for datagrams coalesced by UDP_GRO (the largest a coalesced buffer can get)
+#define GRO_BUFFSIZE 65536
+//Most datagrams sendBulk() hands to one sendmmsg() call (the kernel's UIO_MAXIOV)
+#define BULK_BATCH 1024
+//Limits of one UDP_SEGMENT send: segments per call, and payload bytes (one IPv4 packet)
+#define GSO_MAX_SEGMENTS 64
+#define GSO_MAX_BYTES 65507
+//Depth of the firmware's input FIFOs and the level they stop taking words at (IN_FIFO_SIZE and IN_FIFO_AFULL in eth_common.vhd)
+#define IN_FIFO_SIZE 2048
+#define IN_FIFO_AFULL (IN_FIFO_SIZE-100)
+#define WAIT_TIME 1000
+
+//Receive backends for the asynchronous receive threads
+enum AsyncBackend {
+  BACKEND_UDP, //Kernel UDP socket (udp_server)
+  BACKEND_PACKET, //Raw Ethernet frames from an AF_PACKET TPACKET_V3 ring (PacketSocket)
+  BACKEND_URING, //io_uring multishot receive with the file writes queued on the same ring (UringQueue), falls back to BACKEND_UDP
+  BACKEND_XDP //AF_XDP socket fed by an XDP program steering the port's frames into shared memory (XdpSocket)
+};
+
+//Per-thread receive settings for the asynchronous receive threads
+struct async_opts_t {
+  async_opts_t() : batch_size(1), timeout_ms(WAIT_TIME), rcvbuf_bytes(0), ring_slots(1024),
+		   backend(BACKEND_UDP), packet_block_size(1<<20), packet_block_count(64),
+		   xdp_queue(0), xdp_frames(4096), xdp_native(false), track_sequence(false), check_counters(false), busy_poll_us(0),
+		   timestamps(false), hardware_timestamps(false), gro(false),
+		   filter_source(false) {};
+  //Number of datagrams to drain per recvmmsg() call (1 receives one datagram per call)
+  int batch_size;
+  //Milliseconds to wait for data before checking if the thread should stop
+  int timeout_ms;
+  //Kernel receive buffer size to request, in bytes (0 keeps the system default)
+  int rcvbuf_bytes;
+  //Packets buffered between the receive and writer threads (0 writes from the receive thread). For BACKEND_URING, the number of buffers provided to the kernel.
+  int ring_slots;
+  AsyncBackend backend;
+  //BACKEND_PACKET/BACKEND_XDP: network interface to capture on (empty finds the interface holding the server address)
+  std::string interface;
+  //BACKEND_PACKET: size (a multiple of the page size) and number of blocks in the mapped ring
+  int packet_block_size;
+  int packet_block_count;
+  //BACKEND_XDP: RX queue the board's frames arrive on, number of frames of shared memory (a power of two), and whether to try native (driver) mode instead of generic mode
+  int xdp_queue;
+  int xdp_frames;
+  bool xdp_native;
+  //Strip the application header (ENET_HeaderConfig bit 3) from each packet and check the frame sequence numbers (see SequenceTracker)
+  bool track_sequence;
+  //Check the data as the test counter stream of the port's FIFO (see ODILEServer::setCounters and CounterChecker). With track_sequence, breaks at lost frames are told apart from the board's own losses.
+  bool check_counters;
+  //BACKEND_UDP: busy-poll the socket for this many microseconds per receive call instead of sleeping in select() (0 sleeps, see udp_server::enable_busy_poll)
+  int busy_poll_us;
+  //BACKEND_UDP/BACKEND_PACKET: have the kernel timestamp each packet, and keep histograms of the gaps between packets and of the delay from the kernel to the receive loop (see ODILEServer::getArrivalGaps).
+  //With BACKEND_PACKET the delay includes the time a packet waits for its ring block to be handed over.
+  bool timestamps;
+  //BACKEND_UDP: also ask for NIC timestamps, used for the gaps when the device provides them (see udp_server::enable_timestamps)
+  bool hardware_timestamps;
+  //BACKEND_UDP: let the kernel coalesce consecutive datagrams (UDP_GRO), so each receive slot holds up to GRO_BUFFSIZE bytes that are written in one go. Each ring slot then takes GRO_BUFFSIZE bytes. Not used by the threads of a session, which merge frame by frame.
+  bool gro;
+  //BACKEND_UDP/BACKEND_URING: have the kernel drop datagrams that don't come from the board interface sending to the port (its ENET_IP1/*_IP0 address, from the port itself), see udp_server::attach_filter
+  bool filter_source;
+  //CPU, scheduling and memory policy of the receive thread, and of the writer (or session merger) thread
+  thread_policy_t receive_policy;
+  thread_policy_t writer_policy;
+};
 
 struct async_arg_t {
   bool stop;
@@ -20,6 +106,158 @@ struct async_arg_t {
   int nrows;
   int ncols;
   int nread;
+  //Datagrams dropped by the kernel on this thread's socket
+  int ndropped;
+  //Largest datagram the board sends to port, which sizes the receive buffers (see ODILEServer::datagramBytes)
+  int datagram_bytes;
+  //Datagrams larger than that, which lost their tail
+  int ntruncated;
+  //Receive buffer size actually granted by the kernel, in bytes
+  int rcvbuf_bytes;
+  //Occupancy of the ring between the receive and writer threads, published by the receive thread
+  StatsSnapshot<ring_stats_t> ring_stats;
+  //Process CPU time (user+system, in seconds) when the thread started, and used while it ran. Counts the whole process, so it includes the writer and any kernel io_uring workers.
+  double cpu_start;
+  double cpu_seconds;
+  //IP address of the board interface sending to port (for opts.filter_source)
+  std::string board_address;
+  //MAC address and ENET_HeaderConfig of the board interface sending to port (for BACKEND_PACKET)
+  uint8_t board_mac[6];
+  uint16_t header_config;
+  //Sequence continuity of the frames received, for opts.track_sequence
+  SequenceTracker tracker;
+  //Continuity of the counter data, for opts.check_counters
+  CounterChecker counter_checker;
+  async_opts_t opts;
+  //For the threads of an acquisition session: ring to the session's merger, which writes the output instead of this thread (NULL otherwise)
+  PacketRing *output_ring;
+  //Gaps between the arrival times of consecutive packets, and delays from the kernel receiving a packet to this thread handling it, in nanoseconds (for opts.timestamps)
+  LogHistogram arrival_gaps;
+  LogHistogram kernel_delays;
+  int64_t last_arrival_ns;
+};
+
+//An acquisition session: receive threads on several ports (and interfaces) whose packets are merged into one output file by sequence number
+struct session_arg_t {
+  std::vector<int> thread_ids;
+  StreamMerger *merger;
+  std::string outfname;
+  int nrows;
+  int ncols;
+  bool finished;
+  //Policy of the merger thread, and the interface of the first port (for NUMA_NODE_NIC)
+  thread_policy_t policy;
+  std::string ifname;
+};
+
+//A receive group: one receive thread (shard) per data FIFO of an interface, each writing its own file (see ODILEServer::launchGroup)
+struct group_arg_t {
+  std::vector<int> thread_ids;
+  std::vector<int> ports;
+  std::vector<std::string> outfnames;
+};
+
+//Statistics of a receive group, summed over its shards
+struct group_stats_t {
+  group_stats_t() : nshards(0), nrunning(0), words(0), dropped(0), cpu_seconds(0) {};
+  int nshards;
+  //Shards still receiving
+  int nrunning;
+  long long words;
+  int dropped;
+  //Process CPU time since the group started (see ODILEServer::getCpuSeconds)
+  double cpu_seconds;
+  //Continuity of the frames of all shards, for opts.track_sequence
+  seq_stats_t sequence;
+};
+
+//One board of a multi-board receive, with its own output (see ODILEServer::launchDemux)
+struct board_sink_t {
+  std::string address;
+  std::string outfname;
+  DataWriter writer;
+  long nread;
+  long npackets;
+  //Sequence continuity of this board's frames, for opts.track_sequence
+  SequenceTracker tracker;
+};
+
+//A multi-board receive: one socket and thread receiving from several boards, each board's datagrams going to its own sink
+struct demux_arg_t {
+  bool stop;
+  bool finished;
+  int port;
+  std::string ip_address;
+  std::vector<board_sink_t*> boards;
+  SourceTable *sources;
+  //Datagrams from senders that are not one of the boards (not written), and datagrams dropped by the kernel
+  long nstrays;
+  int ndropped;
+  //Receive buffer size and the datagrams larger than it (see async_arg_t)
+  int datagram_bytes;
+  int ntruncated;
+  async_opts_t opts;
+};
+
+//Counters of one board of a multi-board receive
+struct board_stats_t {
+  board_stats_t() : words(0), packets(0) {};
+  std::string address;
+  long words;
+  long packets;
+  seq_stats_t sequence;
+};
+
+//Counters of a multi-board receive (see ODILEServer::getDemuxStats)
+struct demux_stats_t {
+  demux_stats_t() : strays(0), dropped(0), finished(false) {};
+  std::vector<board_stats_t> boards;
+  long strays;
+  int dropped;
+  bool finished;
+};
+
+//Round-trip times of a series of commands, in microseconds (see ODILEServer::measureCommandLatency)
+struct latency_stats_t {
+  latency_stats_t() : count(0), timeouts(0), min_us(0), median_us(0), mean_us(0), max_us(0) {};
+  int count;
+  //Commands that got no reply in time (not included in the times)
+  int timeouts;
+  double min_us;
+  double median_us;
+  double mean_us;
+  double max_us;
+};
+
+//Probes echoed through the loopback FIFO of an Ethernet interface, with their round-trip times in microseconds (see ODILEServer::measureLoopback)
+struct loopback_stats_t {
+  loopback_stats_t() : probes_sent(0), probes_received(0), probes_corrupt(0), words_sent(0), words_received(0), words_skipped(0),
+		       seconds(0), min_us(0), median_us(0), p90_us(0), p99_us(0), p999_us(0), max_us(0) {};
+  long probes_sent;
+  //Probes echoed intact
+  long probes_received;
+  //Probes echoed with a wrong or missing word, and the words thrown away finding the start of the next probe
+  long probes_corrupt;
+  long words_sent;
+  long words_received;
+  long words_skipped;
+  //Time from the first probe sent to the last echo received
+  double seconds;
+  double min_us;
+  double median_us;
+  double p90_us;
+  double p99_us;
+  double p999_us;
+  double max_us;
+};
+
+//A command sent by queueCommand() that has not been replied to yet
+struct pending_command_t {
+  std::string name;
+  //Command word, without the prefix (the board echoes it with 0xF0 in the top byte)
+  uint32_t code;
+  //Whether the echo of the command came back (the board echoes every command before its DON or INV)
+  bool echoed;
 };
 
 //Depreciated
@@ -36,6 +274,8 @@ namespace epcq_consts{
   const int PAGE_SIZE_BYTES=256;
   const int PAGE_SIZE_WORDS=int(PAGE_SIZE_BYTES/4);
   const int SECTOR_BYTES=65536;
+  //How long the flash paths wait for each command reply before giving up. A sector erase (ESE) is the slowest, at up to 3 s.
+  const int COMMAND_TIMEOUT_MS=10000;
 }
 
 class ODILEServer {
@@ -46,8 +286,27 @@ public:
   int sendConfigData();
   int sendConfigData(std::string inifile);
   int readConfigData(std::string inifile);
+  //Payloads that don't fit in one datagram of the MTU are split with sendBulk(). Returns the bytes sent, or -1 if any datagram failed.
   int sendData(std::vector<uint32_t> data, int port);
   int sendData(std::string infile, int port);
+  //MTU of the path to the board (1500, or up to 9000 with jumbo frames), since the board does not reassemble IP fragments
+  void setMTU(int new_mtu);
+  //Most words a datagram to port carries within the MTU, a whole number of the port's write units (see fragmentUnit)
+  int maxDatagramWords(int port);
+  /*
+    Sends a large buffer as datagrams of datagram_words words each, the last one shorter. Uses sendmmsg() (or UDP_SEGMENT offload if gso is set), so a multi-kiloword upload takes a few system calls.
+    Returns the status of each datagram in order: the bytes sent, or -errno if it failed.
+    datagram_words is rounded down to whole write units of the port (address/value pairs on the sequencer ports).
+  */
+  std::vector<int> sendBulk(const std::vector<uint32_t> &data, int port, int datagram_words=epcq_consts::PAGE_SIZE_WORDS, bool gso=false);
+  std::vector<int> sendBulk(std::string infile, int port, int datagram_words=epcq_consts::PAGE_SIZE_WORDS, bool gso=false);
+  /*
+    Paces sendData() and sendBulk() to port so that no more than depth_words words are ever in flight to a board buffer that drains words_per_second words per second (e.g. the loopback FIFO, emptied at the link rate).
+    A rate <= 0 turns pacing off for the port.
+  */
+  void setPacing(int port, double words_per_second, int depth_words=IN_FIFO_AFULL);
+  //Time the sends to port have spent held back by the pacing, in seconds
+  double getPacingWait(int port);
   int sendCommand(std::string cmd_str, int prefix=0, uint32_t secondWord=0xFFFFFFFF);
   //Depreciated
   int sendCommand(ODILECommand cmd);  
@@ -55,6 +314,15 @@ public:
   bool setNSkips(uint16_t nskips);
   bool setNSamples(uint16_t nsamples);
   bool setNTrigSamples(uint16_t nsamples);
+  //Ethernet interface settings of the named block (e.g. "RJ45ConfigBlock"): packet size in words, FIFO enable/priority flags (2 bits per FIFO) and header configuration (HEADER_CONFIG_* bits)
+  bool setPacketSize(std::string block_name, uint16_t nwords);
+  bool setFifoFlags(std::string block_name, uint16_t flags);
+  bool setHeaderConfig(std::string block_name, uint16_t header_config);
+  /*
+    Has the FIFOs in fifo_mask (bit i for FIFO i) of the named interface send an incrementing 32-bit count instead of their data, as a test source (ENET_CounterEnable).
+    The counters advance on 256-speed out of every 256 cycles of the FIFO write clock, so speed 0 writes a word every cycle.
+  */
+  bool setCounters(std::string block_name, uint8_t fifo_mask, uint8_t speed=0);
   ConfigBlockList configBlocks;
   //Synchrounous receive functions
   int recieveData(std::vector<uint32_t> *data, std::string serv_address, int port, int timeout_ms=-1, bool swap_bytes=true);
@@ -64,19 +332,75 @@ public:
   int receiveData(std::vector<uint32_t> *data, int port, int timeout_ms=-1, bool swap_bytes=true) {recieveData(data, port, timeout_ms, swap_bytes);};
 
   //Async thread handler functions
-  int launchAsyncThread(std::string outfile, std::string serv_address, int port, int ncols=-1, int nrows=-1);
+  int launchAsyncThread(std::string outfile, std::string serv_address, int port, int ncols=-1, int nrows=-1, async_opts_t opts=async_opts_t());
   int closeAsyncThread(int thread_id=0);
   bool isValidThread(int thread_id);
   int getWordsRead(int thread_id=0);
+  int getPacketsDropped(int thread_id=0);
+  //Datagrams that were larger than the receive buffers of an async receive thread and got cut short (ENET_PacketSize raised after the thread started, or beyond MAX_DATAGRAM_BYTES)
+  int getPacketsTruncated(int thread_id=0);
+  ring_stats_t getRingStats(int thread_id=0);
+  double getCpuSeconds(int thread_id=0);
+  seq_stats_t getSequenceStats(int thread_id=0);
+  std::vector<loss_range_t> getLossMap(int thread_id=0);
+  counter_stats_t getCounterStats(int thread_id=0);
+  histogram_t getArrivalGaps(int thread_id=0);
+  histogram_t getKernelDelays(int thread_id=0);
   int getWordsToRead(int nrows, int ncols, int nskips);
+  //Acquisition sessions over several ports
+  int launchSession(std::string outfile, std::string serv_address, std::vector<int> ports, int nrows=-1, int ncols=-1, async_opts_t opts=async_opts_t());
+  int closeSession(int session_id=0);
+  bool isValidSession(int session_id);
+  std::vector<int> getSessionThreads(int session_id=0);
+  merge_stats_t getMergeStats(int session_id=0);
+  //Sharded receive groups over the data FIFOs of an interface
+  int launchGroup(std::string outfile, std::string serv_address, std::string block_name, int nrows=-1, int ncols=-1, async_opts_t opts=async_opts_t());
+  int closeGroup(int group_id=0);
+  bool isValidGroup(int group_id);
+  std::vector<int> getGroupThreads(int group_id=0);
+  std::vector<std::string> getGroupFiles(int group_id=0);
+  group_stats_t getGroupStats(int group_id=0);
+  //Receiving from several boards on one port
+  int launchDemux(std::vector<std::string> boards, std::vector<std::string> outfiles, std::string serv_address, int port, int nrows=-1, int ncols=-1, async_opts_t opts=async_opts_t());
+  int closeDemux(int demux_id=0);
+  demux_stats_t getDemuxStats(int demux_id=0);
   //Helper to convert string to ODILECommand
   static ODILECommand stringToCommand(std::string cmd_str);
   static uint32_t stringToInt(std::string str);
 
   int writeFirmware(std::string fname, std::string mapfname, uint32_t start_address);
   bool waitForDone(std::string command="NON", int timeout_ms=1000);
+  /*
+    Pipelined commands: queueCommand() sends a command without waiting for its reply, as long as fewer than the command window (setCommandWindow) are in flight. Otherwise it first waits up to timeout_ms for the oldest to be replied to.
+    The board replies to commands in the order it gets them, and the replies carry no tag, so each DON/ERR/INV reply completes the oldest command in flight. Commands that reply DON when they finish (ESE, EWR, ERD) complete when they finish.
+    flushCommands() waits for every command in flight (timeout_ms for each, -1 waits forever) and returns the number that failed (ERR or INV reply, or no reply) since the last flush. A reply that doesn't come in time fails every command in flight, since the later replies could no longer be matched up.
+    The DON sent at the end of a sequence or scan would be taken for a reply, so don't pipeline commands while one may finish.
+    sendCommand(), waitForDone() and recieveData() on COMMAND_PORT read the same reply socket, so they first wait for the commands in flight (their failures still count towards the next flushCommands()).
+  */
+  void setCommandWindow(int window);
+  bool queueCommand(std::string cmd_str, int prefix=0, uint32_t secondWord=0xFFFFFFFF, int timeout_ms=1000);
+  int flushCommands(int timeout_ms=1000);
+  //Policy the calling thread switches to while it waits for command replies in waitForDone()
+  void setCommandPolicy(thread_policy_t policy);
+  //Busy-polls the command reply socket for this many microseconds per receive instead of sleeping in select() (0 turns it off)
+  void setBusyPoll(int usecs);
+  latency_stats_t measureCommandLatency(std::string cmd_str, int count, int timeout_ms=1000);
+  /*
+    Sends probes of probe_words words (ENET_PacketSize if -1) to the loopback port of the named interface for the given time, paced to words_per_second (0 sends as fast as it can), and checks what comes back.
+    Each probe holds its number, the time it was sent and a pattern derived from its number, so the echo is checked word for word and timed. The loopback FIFO (ENET_FIFO bits 9:8) must be enabled on the board.
+    The echoes are received on serv_address (by default the interface's server address in the configuration).
+  */
+  loopback_stats_t measureLoopback(std::string block_name, double seconds, double words_per_second, int probe_words=-1, std::string serv_address=NULL_IPADDRESS);
+  //Drops datagrams that don't come from the board in the kernel, on the command reply and synchronous receive sockets (see async_opts_t::filter_source for the async threads)
+  void setSourceFilter(bool enable);
+  int getFilteredPackets();
 
   void setServerAddress(std::string new_address);
+  //The synchronous receives keep their sockets bound between calls, so another ODILEServer or process (e.g. send_command) can't bind the same port meanwhile (see receiveSocket)
+  void openReceiveSocket(int port, std::string serv_address=NULL_IPADDRESS);
+  void closeReceiveSockets();
+  //Number of sockets sendData() and the synchronous receives have created so far
+  int getSocketsCreated();
 
   int readEPCQ(std::string ofname, uint32_t start_address, int words_to_read);
   int writeEPCQ(std::vector<uint32_t> data, uint32_t start_address, bool perform_erase=true);
@@ -93,7 +417,41 @@ private:
   udp_client_server::udp_client cmdClient;	
   std::vector<async_arg_t*> thread_args;
   std::vector<pthread_t> threads;
+  std::vector<session_arg_t*> session_args;
+  std::vector<pthread_t> session_threads;
+  std::vector<group_arg_t*> group_args;
+  std::vector<demux_arg_t*> demux_args;
+  std::vector<pthread_t> demux_threads;
   std::string server_address;
+  thread_policy_t command_policy;
+  bool has_command_policy;
+  int busy_poll_us;
+  bool filter_source;
+  int filtered_packets;
+  std::string boardServerAddress(int port);
+  std::string boardAddress(int port);
+  int datagramBytes(int port);
+  void attachSourceFilter(udp_client_server::udp_server &server);
+  //Long-lived sockets of the synchronous receives, by (address, port)
+  std::map<std::pair<std::string,int>, udp_client_server::udp_server*> receive_sockets;
+  udp_client_server::udp_server* receiveSocket(std::string serv_address, int port);
+  void prepareReplySocket();
+  static std::vector<uint32_t> commandWords(std::string cmd, int prefix, uint32_t secondWord);
+  //Pipelined commands in flight, oldest first (see queueCommand)
+  std::deque<pending_command_t> pending_commands;
+  int command_window;
+  int failed_commands;
+  void handleCommandReplies(const uint32_t *buffer, int nwords);
+  bool completeOldestCommand(int timeout_ms);
+  void completePendingCommands(int timeout_ms=1000);
+  //Connected sockets of sendData(), by destination port
+  std::map<int, udp_client_server::udp_client*> send_sockets;
+  udp_client_server::udp_client* sendSocket(int port);
+  int sockets_created;
+  //Pacing of the sends, by destination port (see setPacing)
+  std::map<int, TokenBucket*> pacers;
+  int mtu;
+  int startAsyncThread(std::string outfile, std::string serv_address, int port, int nrows, int ncols, async_opts_t opts, PacketRing *output_ring);
 
 };
 
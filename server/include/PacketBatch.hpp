@@ -0,0 +1,61 @@
+#ifndef PACKET_BATCH_HPP
+#define PACKET_BATCH_HPP
+
+#include "udp_client_server.h"
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <cstdint>
+
+//Space reserved for the ancillary data (control messages) of each slot
+#define PACKET_CONTROL_SIZE 256
+
+/*
+  Preallocated array of packet slots, used to drain many datagrams from a udp_server with a single recvmmsg() call.
+  All slots are allocated once when the batch is created, so nothing is allocated in the receive loop.
+*/
+class PacketBatch {
+public:
+  PacketBatch(int nslots, int slot_size);
+  ~PacketBatch();
+  //Receives up to max (or size()) datagrams, waiting at most timeout_ms for the first one. Returns the number of datagrams received.
+  int recv(udp_client_server::udp_server &server, int timeout_ms, int max=-1);
+  //Points a slot at an external buffer of at least slot_size bytes (e.g. a PacketRing slot)
+  void setBuffer(int idx, char *buffer) {iovecs[idx].iov_base=buffer;};
+  char* data(int idx) {return (char*)iovecs[idx].iov_base;};
+  int length(int idx) {return msgs[idx].msg_len;};
+  //Whether a datagram was larger than its slot and got cut short
+  bool truncated(int idx) {return (msgs[idx].msg_hdr.msg_flags & MSG_TRUNC) != 0;};
+  int size() {return nslots;};
+  //Latest SO_RXQ_OVFL drop counter seen (the socket must have drop counting enabled)
+  uint32_t dropCount() {return drop_count;};
+  //Kernel receive time of a datagram in nanoseconds (CLOCK_REALTIME), or 0 if the socket doesn't timestamp (see udp_server::enable_timestamps)
+  int64_t timestamp(int idx) {return timestamps[idx].software;};
+  //NIC receive time of a datagram in nanoseconds (NIC clock), or 0 if the socket or the device doesn't do hardware timestamps
+  int64_t hardwareTimestamp(int idx) {return timestamps[idx].hardware;};
+  //Size of the datagrams the kernel coalesced into a slot (see udp_server::enable_gro), or 0 if the slot holds a single datagram
+  int segmentSize(int idx) {return segment_sizes[idx];};
+  //IPv4 address (in network byte order) and port of the sender of a datagram
+  uint32_t sourceAddress(int idx) {return names[idx].sin_addr.s_addr;};
+  int sourcePort(int idx) {return ntohs(names[idx].sin_port);};
+private:
+  //Not copyable, we own the slot memory
+  PacketBatch(const PacketBatch&);
+  PacketBatch& operator=(const PacketBatch&);
+  int nslots;
+  int slot_size;
+  char *buffers;
+  struct mmsghdr *msgs;
+  struct iovec *iovecs;
+  char *control;
+  uint32_t drop_count;
+  struct slot_time_t {
+    int64_t software;
+    int64_t hardware;
+  };
+  slot_time_t *timestamps;
+  int *segment_sizes;
+  struct sockaddr_in *names;
+};
+
+#endif //PACKET_BATCH_HPP
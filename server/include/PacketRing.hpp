@@ -0,0 +1,84 @@
+#ifndef PACKET_RING_HPP
+#define PACKET_RING_HPP
+
+#include <atomic>
+#include <cstdint>
+
+//A single packet held in the ring
+struct packet_slot_t {
+  char *data;
+  int len;
+  //For slots pointing into memory owned by a receive backend: called by the consumer with the slot data once the slot has been written (NULL otherwise)
+  void (*release)(void *ctx, char *data);
+  void *release_ctx;
+  //Application header stripped from the packet by the receive thread (see async_opts_t::track_sequence), for consumers that merge several rings
+  uint32_t app_header;
+};
+
+//Occupancy counters of a PacketRing, used to size the ring for the disks we write to
+struct ring_stats_t {
+  ring_stats_t() : capacity(0), high_water(0), stalls(0), stall_ms(0) {};
+  //Number of slots in the ring
+  int capacity;
+  //Largest number of slots ever waiting for the writer
+  int high_water;
+  //Number of times the receiver found the ring full and had to wait for the writer
+  int stalls;
+  //Total time the receiver spent waiting on a full ring
+  double stall_ms;
+};
+
+/*
+  Bounded single-producer/single-consumer lock-free ring of packet buffers. Connects an acquisition thread (the producer, which receives straight into the slots) to a writer thread (the consumer, which writes them to disk). 
+  Slot buffers are allocated once when the ring is created. Zero-copy producers can create the ring with a slot_size of 0 and point the slots at their own memory instead.
+  Only one thread may call the producer functions and only one thread may call the consumer functions.
+*/
+class PacketRing {
+public:
+  PacketRing(int nslots, int slot_size);
+  ~PacketRing();
+  int capacity() {return nslots;};
+  int slotSize() {return slot_size;};
+  //Producer side: waits until at least one slot is free and returns the number of free slots
+  int waitFree();
+  //i-th free slot after the last published one
+  packet_slot_t& producerSlot(int i) {return slots[(head_local+i) & mask];};
+  //Buffer allocated for the i-th free slot (slot_size bytes), to receive into
+  char* producerBuffer(int i) {return storage+((head_local+i) & mask)*slot_size;};
+  void publish(int n);
+  //Waits until the consumer has released every published slot (before freeing the memory zero-copy slots point to)
+  void waitEmpty();
+  //Tells the consumer no more packets are coming
+  void close();
+  //Consumer side: waits until at least one slot is filled and returns the number of filled slots, or 0 once the ring is closed and drained
+  int waitFilled();
+  //Number of filled slots, without waiting. Sets drained once the ring is closed and every slot has been released.
+  int pollFilled(bool *drained);
+  //i-th filled slot after the last released one
+  packet_slot_t& consumerSlot(int i) {return slots[(tail_local+i) & mask];};
+  void release(int n);
+  ring_stats_t getStats();
+  //Spins, then yields, then sleeps, depending on how many times we have polled (npolls is incremented)
+  static void backoff(int &npolls);
+private:
+  PacketRing(const PacketRing&);
+  PacketRing& operator=(const PacketRing&);
+  int nslots;
+  uint64_t mask;
+  int slot_size;
+  char *storage;
+  packet_slot_t *slots;
+  //Keep the producer and consumer indices on separate cache lines
+  char pad0[64];
+  std::atomic<uint64_t> head;
+  uint64_t head_local;
+  char pad1[64];
+  std::atomic<uint64_t> tail;
+  uint64_t tail_local;
+  char pad2[64];
+  std::atomic<bool> closed;
+  //Written by the producer only
+  ring_stats_t stats;
+};
+
+#endif //PACKET_RING_HPP
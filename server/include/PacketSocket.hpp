@@ -0,0 +1,60 @@
+#ifndef PACKET_SOCKET_HPP
+#define PACKET_SOCKET_HPP
+
+#include <string>
+#include <stdexcept>
+#include <cstdint>
+#include <linux/if_packet.h>
+
+//Bits of ENET_HeaderConfig (see header_generator.vhd)
+#define HEADER_CONFIG_ETH 0x1
+#define HEADER_CONFIG_IP 0x2
+#define HEADER_CONFIG_UDP 0x4
+#define HEADER_CONFIG_APP 0x8
+
+//Time the kernel waits before handing over a partially filled block
+#define PACKET_BLOCK_TIMEOUT_MS 10
+
+class packet_socket_runtime_error : public std::runtime_error {
+public:
+  packet_socket_runtime_error(const std::string &w) : std::runtime_error(w) {};
+};
+
+/*
+  Raw Ethernet receive socket (AF_PACKET) with a memory-mapped TPACKET_V3 block ring. Captures the frames sent by one ODILE interface (matched on the source MAC address by a kernel socket filter), so the data can be read without going through the kernel UDP stack, or with the IP/UDP headers turned off entirely in ENET_HeaderConfig.
+  Frames stay in the mapped ring until their block is released, so the payloads can be handed to the writer stage without copying.
+*/
+class PacketSocket {
+public:
+  //header_config is the ENET_HeaderConfig value of the interface, port is the UDP port to keep when the UDP header is enabled
+  PacketSocket(std::string ifname, const uint8_t board_mac[6], uint16_t header_config, int port, int block_size, int block_count);
+  ~PacketSocket();
+  //Waits up to timeout_ms for the next block filled by the kernel. Returns NULL if none is ready.
+  struct tpacket_block_desc* waitBlock(int timeout_ms);
+  //Hands a block back to the kernel. Static so it can be used as a PacketRing release function.
+  static void releaseBlock(void *block, char *data=NULL);
+  //First packet of a block, and the packet following pkt
+  static struct tpacket3_hdr* firstPacket(struct tpacket_block_desc *block);
+  static struct tpacket3_hdr* nextPacket(struct tpacket3_hdr *pkt);
+  //Strips the Ethernet/IP/UDP headers from a captured frame. Returns NULL (and len=0) if the frame is not for our port.
+  char* payload(struct tpacket3_hdr *pkt, int *len);
+  //Frames dropped by the kernel because the ring was full
+  int getDropCount();
+  int get_socket() const {return f_socket;};
+  //Finds the name of the network interface holding an IPv4 address
+  static std::string findInterface(std::string ip_address);
+private:
+  PacketSocket(const PacketSocket&);
+  PacketSocket& operator=(const PacketSocket&);
+  int f_socket;
+  char *ring;
+  size_t ring_size;
+  int block_count;
+  int block_size;
+  int curr_block;
+  uint16_t header_config;
+  int port;
+  int ndropped;
+};
+
+#endif //PACKET_SOCKET_HPP
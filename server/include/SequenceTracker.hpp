@@ -0,0 +1,71 @@
+#ifndef SEQUENCE_TRACKER_HPP
+#define SEQUENCE_TRACKER_HPP
+
+#include <vector>
+#include <ostream>
+#include <cstdint>
+#include "StatsSnapshot.hpp"
+
+//The application header (ENET_HeaderConfig bit 3) holds the FIFO index in bits 31:24 and a per-FIFO frame counter in bits 23:0
+#define APP_HEADER_STREAM(h) (((h) >> 24) & 0xFF)
+#define APP_HEADER_SEQ(h) ((h) & 0xFFFFFF)
+#define APP_SEQ_BITS 24
+#define APP_MAX_STREAMS 256
+
+//A run of frames that never arrived
+struct loss_range_t {
+  //Stream (FIFO index) and sequence number of the first missing frame
+  int stream;
+  uint32_t first_seq;
+  uint32_t nframes;
+  //Position of the gap in the data written for this thread, in words (application headers excluded)
+  long word_offset;
+  //Estimated number of missing words (nframes times the size of the frame after the gap)
+  long nwords;
+};
+
+//Continuity counters, summed over all streams
+struct seq_stats_t {
+  seq_stats_t() : frames(0), gaps(0), missing_frames(0), duplicates(0), reorders(0) {};
+  long frames;
+  long gaps;
+  long missing_frames;
+  long duplicates;
+  long reorders;
+};
+
+/*
+  Checks the application header of every frame received by an acquisition thread. Keeps track of the next expected sequence number of each stream and records the frames that never arrive in a compact loss map, so the data written around a gap can be realigned.
+  A frame older than expected either fills a hole in the loss map (a reorder) or is a duplicate. Neither is written out: the loss map then describes exactly what is missing from the output.
+*/
+class SequenceTracker {
+public:
+  SequenceTracker();
+  //Checks a frame with the given application header and payload size (in words). word_offset is where its payload would be written. Returns false if the frame should be dropped.
+  bool check(uint32_t app_header, int nwords, long word_offset);
+  //Counters as of the last frame checked. May be called from any thread.
+  seq_stats_t getStats() const {return published.read();};
+  const std::vector<loss_range_t>& getLossMap() const {return loss_map;};
+  //Prints the per-stream summary and the loss map
+  void report(std::ostream &out, int max_ranges=20) const;
+private:
+  SequenceTracker(const SequenceTracker&);
+  SequenceTracker& operator=(const SequenceTracker&);
+  //Does the work of check(), on the tracker's own counters
+  bool checkFrame(uint32_t app_header, int nwords, long word_offset);
+  struct stream_state_t {
+    stream_state_t() : seen(false), next_seq(0), stats() {};
+    bool seen;
+    uint32_t next_seq;
+    seq_stats_t stats;
+  };
+  //True if seq falls in one of the stream's recent gaps (a late frame rather than a duplicate)
+  bool inGap(int stream, uint32_t seq);
+  stream_state_t streams[APP_MAX_STREAMS];
+  std::vector<loss_range_t> loss_map;
+  seq_stats_t stats;
+  //Copy of stats for other threads, published after every frame
+  StatsSnapshot<seq_stats_t> published;
+};
+
+#endif //SEQUENCE_TRACKER_HPP
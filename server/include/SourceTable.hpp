@@ -0,0 +1,29 @@
+#ifndef SOURCE_TABLE_HPP
+#define SOURCE_TABLE_HPP
+
+#include <vector>
+#include <cstdint>
+
+/*
+  Small open-addressing hash table from IPv4 source addresses to board indexes, to demultiplex the datagrams of several boards received on one socket.
+  The table is sized once (at least twice the number of boards) and never grows, so lookups in the receive loop never allocate and rarely probe more than one slot.
+*/
+class SourceTable {
+public:
+  SourceTable(int nboards);
+  //Adds an address (in network byte order) with its board index, for at most nboards addresses. Returns false if the address is already there.
+  bool add(uint32_t addr, int index);
+  //Board index of an address, or -1 if it was never added
+  int find(uint32_t addr) const;
+  //Slot an address's probe starts from
+  uint32_t slot(uint32_t addr) const;
+private:
+  std::vector<uint32_t> keys;
+  //-1 marks an empty slot
+  std::vector<int> values;
+  uint32_t mask;
+  //32 minus the number of bits of a slot index
+  int shift;
+};
+
+#endif //SOURCE_TABLE_HPP
@@ -0,0 +1,53 @@
+#ifndef STATS_SNAPSHOT_HPP
+#define STATS_SNAPSHOT_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+
+/*
+  Latest copy of a struct of counters, published by the thread that updates them and read by any other thread (a seqlock).
+  A reader retries while a copy is being published, so it never sees half of one update and half of the next. T must be trivially copyable.
+*/
+template <class T>
+class StatsSnapshot {
+public:
+  StatsSnapshot() : seq(0) {
+    publish(T());
+  };
+  //Only one thread may publish
+  void publish(const T &value) {
+    uint64_t words[NWORDS]={};
+    memcpy(words, &value, sizeof(T));
+    uint32_t s=seq.load(std::memory_order_relaxed);
+    seq.store(s+1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (int i=0; i < NWORDS; i++) {
+      data[i].store(words[i], std::memory_order_relaxed);
+    };
+    seq.store(s+2, std::memory_order_release);
+  };
+  T read() const {
+    uint64_t words[NWORDS];
+    uint32_t before, after;
+    do {
+      before=seq.load(std::memory_order_acquire);
+      for (int i=0; i < NWORDS; i++) {
+	words[i]=data[i].load(std::memory_order_relaxed);
+      };
+      std::atomic_thread_fence(std::memory_order_acquire);
+      after=seq.load(std::memory_order_relaxed);
+    } while ((before & 1) || before != after);
+    T value;
+    memcpy(&value, words, sizeof(T));
+    return value;
+  };
+private:
+  StatsSnapshot(const StatsSnapshot&);
+  StatsSnapshot& operator=(const StatsSnapshot&);
+  static const int NWORDS=(sizeof(T)+7)/8;
+  std::atomic<uint32_t> seq;
+  std::atomic<uint64_t> data[NWORDS];
+};
+
+#endif //STATS_SNAPSHOT_HPP
@@ -0,0 +1,69 @@
+#ifndef STREAM_MERGER_HPP
+#define STREAM_MERGER_HPP
+
+#include "PacketRing.hpp"
+#include "DataWriter.hpp"
+#include "StatsSnapshot.hpp"
+#include <vector>
+
+//Counters of a StreamMerger
+struct merge_stats_t {
+  merge_stats_t() : frames(0), words(0), lost(0), late(0) {};
+  //Frames and words written to the output
+  long frames;
+  long words;
+  //Frames skipped because they never arrived (or did not arrive in time)
+  long lost;
+  //Frames dropped because the output had already moved past their sequence number
+  long late;
+};
+
+/*
+  Merges the packets of several acquisition threads into one output, in the order given by their application header sequence numbers (see SequenceTracker).
+  Each input is a PacketRing filled by one receive thread. The inputs take turns in the order they were added: the n-th frame of every input is written before the (n+1)-th. This is the order of frames dealt out in turn to several links, as well as of FIFOs read out in step.
+  The frame counters of the FIFOs run freely and are not reset together, so each input is aligned on the sequence number of its own first frame: turn n takes the frame numbered first+n from every input. An input whose first frame arrives late joins at the turn in progress.
+  A frame that never arrives is skipped once a later frame of the same input arrives, or after waiting timeout_ms while the other inputs have frames to write, so a lost frame or a dead link never holds up the others for long.
+  Runs on its own thread (the single consumer of every input ring).
+*/
+class StreamMerger {
+public:
+  StreamMerger(int timeout_ms);
+  ~StreamMerger();
+  //Adds an input fed through a new ring of nslots slots of slot_size bytes (see PacketRing)
+  PacketRing* addInput(int nslots, int slot_size);
+  int inputs() {return int(rings.size());};
+  //Writes the merged packets to writer, until every input ring has been closed and drained
+  void run(DataWriter &writer);
+  //Counters as of the last frame merged. May be called from any thread.
+  merge_stats_t getStats() {return published.read();};
+private:
+  StreamMerger(const StreamMerger&);
+  StreamMerger& operator=(const StreamMerger&);
+  //Waits for the first frame of every input (for timeout_ms at most once one has arrived), to align the inputs on. Returns false if every input closed empty.
+  bool start();
+  //Writes the frame of input i for the current turn, or skips it
+  void mergeInput(int i, DataWriter &writer);
+  //True if an input other than i has frames waiting
+  bool othersWaiting(int i);
+  //Releases the oldest slot of input i
+  void releaseHead(int i);
+  //Drops the empty slots (duplicates and invalid frames) at the head of input i and returns the number of frames left
+  int pollFrames(int i, bool *drained);
+  //Sequence number input i has in the current turn
+  uint32_t expectedSeq(int i);
+  std::vector<PacketRing*> rings;
+  std::vector<bool> done;
+  //Inputs that timed out are skipped without waiting until they deliver again
+  std::vector<bool> stalled;
+  //Sequence number of the first frame of each input, once it has arrived
+  std::vector<uint32_t> first_seq;
+  std::vector<bool> aligned;
+  int timeout_ms;
+  //Number of turns taken so far
+  uint32_t turn;
+  merge_stats_t stats;
+  //Copy of stats for other threads, published after every turn of an input
+  StatsSnapshot<merge_stats_t> published;
+};
+
+#endif //STREAM_MERGER_HPP
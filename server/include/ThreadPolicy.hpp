@@ -0,0 +1,62 @@
+#ifndef THREAD_POLICY_HPP
+#define THREAD_POLICY_HPP
+
+#include <string>
+#include <vector>
+#include <sched.h>
+
+//numa_node value asking for the NUMA node the receive interface is attached to
+#define NUMA_NODE_NIC -2
+
+//Scheduling and memory placement of an acquisition thread (receive, writer or command reply thread)
+struct thread_policy_t {
+  thread_policy_t() : rt_priority(0), lock_memory(false), numa_node(-1) {};
+  //CPUs the thread may run on. If empty and numa_node is set, the CPUs of that node; if both are unset, the affinity is left alone.
+  std::vector<int> cpus;
+  //SCHED_FIFO priority (1 to 99), 0 keeps the normal time-sharing scheduler. Needs CAP_SYS_NICE (or an RLIMIT_RTPRIO allowance).
+  int rt_priority;
+  //Locks all current and future memory of the process (mlockall), so the rings and mapped buffers are never paged out
+  bool lock_memory;
+  //NUMA node to run on and allocate from (-1 leaves placement alone, NUMA_NODE_NIC picks the node of the receive interface)
+  int numa_node;
+};
+
+//Scheduling state of a thread, to restore it after applying a policy for a while
+struct thread_sched_state_t {
+  cpu_set_t cpus;
+  int sched_policy;
+  struct sched_param param;
+  int mem_mode;
+  unsigned long mem_nodes;
+};
+
+/*
+  Applies policy to the calling thread. ifname is the network interface the thread receives from, for NUMA_NODE_NIC.
+  Each setting that can't be applied (missing privileges, unknown node) prints a warning and is skipped, so a thread always runs, just with less isolation. Returns false if anything was skipped.
+*/
+bool applyThreadPolicy(const thread_policy_t &policy, std::string ifname="");
+//Saves and restores the CPU affinity, scheduler and memory policy of the calling thread
+void saveThreadState(thread_sched_state_t *state);
+void restoreThreadState(const thread_sched_state_t &state);
+//Applies a policy (if not NULL) to the calling thread for the lifetime of the object, then restores the thread's previous scheduling (memory stays locked)
+class ScopedThreadPolicy {
+public:
+  ScopedThreadPolicy(const thread_policy_t *policy, std::string ifname="") : active(policy != NULL) {
+    if (!active) return;
+    saveThreadState(&state);
+    applyThreadPolicy(*policy, ifname);
+  };
+  ~ScopedThreadPolicy() {
+    if (active) restoreThreadState(state);
+  };
+private:
+  bool active;
+  thread_sched_state_t state;
+};
+
+//NUMA node of a network interface's device, or -1 if unknown (virtual interfaces, non-NUMA machines)
+int interfaceNumaNode(std::string ifname);
+//Parses a CPU list such as "0-3,8,10-11" (the format used by taskset and sysfs)
+std::vector<int> parseCpuList(std::string list);
+
+#endif //THREAD_POLICY_HPP
@@ -0,0 +1,34 @@
+#ifndef TOKEN_BUCKET_HPP
+#define TOKEN_BUCKET_HPP
+
+#include <cstdint>
+
+/*
+  Token bucket pacing the words sent to a board buffer that drains at a known rate: it fills at the drain rate up to the buffer depth, and each send takes one token per word.
+  Sending only what the bucket holds keeps the words in flight (sent but not yet drained) within the depth, however bursty the caller is.
+*/
+class TokenBucket {
+public:
+  //rate in words per second, depth in words. Starts full.
+  TokenBucket(double rate, double depth);
+  /*
+    Waits until cost words fit (a full bucket, for costs above the depth), then takes them, and as many more lots of cost words as already fit, up to max_units lots in total.
+    Returns the number of lots taken (at least 1).
+  */
+  int acquire(double cost, int max_units=1);
+  //Gives back units lots of cost words taken by acquire() that were not sent after all
+  void refund(double cost, int units);
+  double rate() const {return words_per_second;};
+  double depth() const {return bucket_depth;};
+  //Total time acquire() has spent waiting, in nanoseconds
+  uint64_t waitedNs() const {return waited_ns;};
+private:
+  void refill(int64_t now_ns);
+  double words_per_second;
+  double bucket_depth;
+  double tokens;
+  int64_t last_ns;
+  uint64_t waited_ns;
+};
+
+#endif //TOKEN_BUCKET_HPP
@@ -0,0 +1,19 @@
+#ifndef TOOL_OPTIONS_HPP
+#define TOOL_OPTIONS_HPP
+
+#include "ODILEServer.hpp"
+#include <string>
+#include <vector>
+
+//Helpers shared by the command line tools in main/
+
+//Monotonic time in seconds
+double monotonicSeconds();
+//Parses a comma separated list of numbers, decimal or hex with 0x (e.g. "128,0x200")
+std::vector<double> parseNumberList(std::string list);
+//Configuration block of an Ethernet interface named on the command line (sfp0, sfp1 or rj45). Unknown names are reported and give the RJ45 block.
+std::string parseInterface(std::string name);
+//Receive backend named on the command line (udp, packet, uring or xdp). Unknown names are reported and give BACKEND_UDP.
+AsyncBackend parseBackend(std::string name);
+
+#endif //TOOL_OPTIONS_HPP
@@ -0,0 +1,81 @@
+#ifndef URING_QUEUE_HPP
+#define URING_QUEUE_HPP
+
+#include <string>
+#include <stdexcept>
+#include <cstdint>
+
+#if defined __has_include
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+#endif
+
+//Multishot receive and provided buffer rings need Linux 6.0 headers
+#ifdef IORING_RECV_MULTISHOT
+#define URING_SUPPORTED
+#else
+struct io_uring_sqe;
+struct io_uring_cqe;
+struct io_uring_buf_ring;
+#endif
+
+class uring_runtime_error : public std::runtime_error {
+public:
+  uring_runtime_error(const std::string &w) : std::runtime_error(w) {};
+};
+
+/*
+  Minimal io_uring instance (submission and completion queues) with one provided buffer ring, driven through the raw system calls so we do not depend on liburing.
+  The constructor throws uring_runtime_error if the running kernel (or the headers we were built with) cannot do multishot receives into provided buffers, so callers can fall back to plain sockets.
+  Not thread safe: one thread submits and reaps.
+*/
+class UringQueue {
+public:
+  //entries is the submission queue size, nbufs (a power of two) buffers of buf_size bytes are provided to the kernel in group 0
+  UringQueue(int entries, int nbufs, int buf_size);
+  ~UringQueue();
+  //Next free submission entry (zeroed), or NULL if the submission queue is full
+  struct io_uring_sqe* getSqe();
+  //Submits all queued entries and waits up to timeout_ms for at least min_complete completions. Returns false on timeout.
+  bool submitAndWait(int min_complete, int timeout_ms);
+  //Oldest unread completion, or NULL if there is none
+  struct io_uring_cqe* peekCqe();
+  void cqeSeen();
+  //Queues a multishot receive on fd into the provided buffers
+  void prepRecvMultishot(int fd, uint64_t user_data);
+  //Queues the cancellation of the request carrying target as its user_data (e.g. a multishot receive, which stays armed until cancelled)
+  void prepCancel(uint64_t target, uint64_t user_data);
+  //Queues a write of len bytes from data (in one of our buffers) at offset in fd
+  void prepWrite(int fd, char *data, int len, uint64_t offset, uint64_t user_data);
+  char* bufferData(int bid) {return buffers+(long)bid*buf_size;};
+  //Gives buffer bid back to the kernel once we are done with it
+  void recycleBuffer(int bid);
+private:
+  UringQueue(const UringQueue&);
+  UringQueue& operator=(const UringQueue&);
+  void cleanup();
+  int ring_fd;
+  void *sq_ptr;
+  size_t sq_size;
+  size_t cq_size;
+  struct io_uring_sqe *sqes;
+  size_t sqes_size;
+  unsigned *sq_head;
+  unsigned *sq_tail;
+  unsigned *sq_array;
+  unsigned sq_mask;
+  unsigned sq_entries;
+  unsigned sq_local_tail;
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned cq_mask;
+  struct io_uring_cqe *cqes;
+  struct io_uring_buf_ring *buf_ring;
+  size_t buf_ring_size;
+  char *buffers;
+  int nbufs;
+  int buf_size;
+};
+
+#endif //URING_QUEUE_HPP
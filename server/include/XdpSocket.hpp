@@ -0,0 +1,69 @@
+#ifndef XDP_SOCKET_HPP
+#define XDP_SOCKET_HPP
+
+#include <string>
+#include <stdexcept>
+#include <cstdint>
+#include <linux/if_xdp.h>
+
+//Size of each UMEM frame. Standard Ethernet frames from the ODILE fit with room to spare.
+#define XDP_FRAME_SIZE 4096
+//Largest frame a UMEM frame holds, after the headroom the kernel keeps in front of it (XDP_PACKET_HEADROOM)
+#define XDP_MAX_FRAME_BYTES (XDP_FRAME_SIZE-256)
+
+class xdp_socket_runtime_error : public std::runtime_error {
+public:
+  xdp_socket_runtime_error(const std::string &w) : std::runtime_error(w) {};
+};
+
+/*
+  AF_XDP receive socket for one ODILE data port. A small XDP program attached to the interface redirects the UDP/IPv4 frames for that port into a UMEM shared with this process; all other traffic is passed on to the kernel as usual.
+  By default the program runs in generic (SKB) mode with copies into the UMEM, which works on any interface, including veth pairs. Native mode needs driver support and tries zero-copy first.
+  Frames stay in the UMEM until they are released, so their payloads can be handed to the writer stage without copying. Only one thread may release frames at a time.
+  Only one XDP program can be attached to an interface, so there can only be one XdpSocket per interface.
+*/
+class XdpSocket {
+public:
+  //Receives frames for UDP port on RX queue queue_id of ifname, with nframes (a power of two) frames of UMEM
+  XdpSocket(std::string ifname, int port, int queue_id, int nframes, bool native_mode=false);
+  ~XdpSocket();
+  //Waits up to timeout_ms for frames. Returns the number of frames received (see frameData), at most max.
+  int waitFrames(int timeout_ms, int max);
+  //UDP payload of the i-th received frame (len is 0 if the frame is not a valid datagram)
+  char* frameData(int i, int *len);
+  //Done reading the first n received frame descriptors. The frames themselves are still ours until released.
+  void consumed(int n);
+  //Gives a frame back to the kernel. Static so it can be used as a PacketRing release function (ctx is the XdpSocket).
+  static void releaseFrame(void *ctx, char *data);
+  //Frames dropped because the UMEM or the receive ring was full
+  int getDropCount();
+  int get_socket() const {return f_socket;};
+private:
+  XdpSocket(const XdpSocket&);
+  XdpSocket& operator=(const XdpSocket&);
+  void cleanup();
+  void loadProgram(int ifindex, int port, int queue_id, bool native_mode);
+  int f_socket;
+  int map_fd;
+  int prog_fd;
+  int link_fd;
+  char *umem;
+  size_t umem_size;
+  int nframes;
+  //Receive ring (consumed by us) and fill ring (produced by us)
+  void *rx_map;
+  size_t rx_map_size;
+  uint32_t *rx_producer;
+  uint32_t *rx_consumer;
+  struct xdp_desc *rx_descs;
+  uint32_t rx_cached_consumer;
+  void *fill_map;
+  size_t fill_map_size;
+  uint32_t *fill_producer;
+  uint64_t *fill_addrs;
+  uint32_t fill_cached_producer;
+  void *comp_map;
+  size_t comp_map_size;
+};
+
+#endif //XDP_SOCKET_HPP
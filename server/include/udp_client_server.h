@@ -20,9 +20,19 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netdb.h>
+#include <netinet/udp.h>
 #include <stdexcept>
 #include <vector>
 
+// UDP_GRO arrived in Linux 5.0, older headers lack it (also the type of its control message)
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+// Same for UDP_SEGMENT (Linux 4.18)
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+
 void printHex(int nbytes, char *buffer);
 void printHex(int buffer);
 
@@ -48,6 +58,9 @@ public:
 
     int                 send(const char *msg, size_t size);
 		int                 send(const std::vector<uint32_t> data);
+    int                 connect();
+    int                 send_batch(struct mmsghdr *msgs, unsigned int vlen);
+    int                 send_segmented(const char *msg, size_t size, int segment_size);
 
 
 private:
@@ -55,6 +68,7 @@ private:
     int                 f_port;
     std::string         f_addr;
     struct addrinfo *   f_addrinfo;
+    bool                f_connected;
 };
 
 
@@ -70,12 +84,39 @@ public:
 
     int                 recv(char *msg, size_t max_size);
     int                 timed_recv(char *msg, size_t max_size, int max_wait_ms);
+    int                 timed_recvmmsg(struct mmsghdr *msgs, unsigned int vlen, int max_wait_ms);
+
+    int                 set_rcvbuf(int size);
+    int                 get_rcvbuf() const;
+    int                 enable_drop_count();
+    int                 get_drop_count() const;
+    int                 enable_busy_poll(int usecs);
+    bool                is_busy_poll() const;
+    int                 enable_timestamps(bool hardware = false);
+    int                 enable_gro();
+    int                 attach_filter(const std::string& src_addr, int src_port = -1);
+    int                 get_truncated_count() const;
 
 private:
+    int                 recv_checked(char *msg, size_t max_size, int flags);
+
+    // deadline and spin count of a busy-polling receive
+    class busy_wait_t
+    {
+    public:
+                        busy_wait_t(int max_wait_ms);
+        bool            again();
+    private:
+        long long       f_deadline_ns;
+        int             f_spins;
+    };
+
     int                 f_socket;
     int                 f_port;
     std::string         f_addr;
     struct addrinfo *   f_addrinfo;
+    bool                f_busy_poll;
+    int                 f_truncated;
 };
 
 } // namespace udp_client_server
@@ -0,0 +1,74 @@
+#include "ODILEServer.hpp"
+#include "ToolOptions.hpp"
+#include <vector>
+#include <unistd.h>
+
+#define TCLAP_SETBASE_ZERO 1
+#include "tclap/CmdLine.h"
+
+using namespace udp_client_server;
+
+int main (int argc, char *argv[]) {
+	//Parse command line arguments
+	std::string ipAddress="192.168.0.3";
+	std::string servIpAddress="192.168.0.1";
+	std::string configFname="config.ini";
+	std::string blockName="RJ45ConfigBlock";
+	std::vector<double> rates;
+	double duration=2;
+	int probeWords=-1;
+	try {
+		TCLAP::CmdLine cmd("Network path check through the loopback port of an ODILE Ethernet interface: sends timestamped probes at each rate, and reports the round-trip times, the echo bandwidth and any corrupted probes.", ' ', "0.1");
+		TCLAP::ValueArg<std::string> ipAddressArg("i", "ip","IP address of ODILE", false, ipAddress, "string",cmd);
+		TCLAP::ValueArg<std::string> servIpAddressArg("s", "sip","IP address of PC", false, servIpAddress, "string",cmd);
+		TCLAP::ValueArg<std::string> configFnameArg("c","config","Configuration file to use (must enable the loopback FIFO in ENET_FIFO)", false, configFname, "string",cmd);
+		TCLAP::ValueArg<std::string> interfaceArg("I","interface","Ethernet interface to test: sfp0, sfp1 or rj45",false,"rj45","string", cmd);
+		TCLAP::ValueArg<std::string> ratesArg("r","rates","Rates to send probes at, in Mbit/s (0 sends as fast as possible)",false,"10,100,300,1000","string", cmd);
+		TCLAP::ValueArg<double> durationArg("d","duration","Seconds to send probes at each rate",false,duration,"double", cmd);
+		TCLAP::ValueArg<int> probeWordsArg("P","probe","Words per probe (default: ENET_PacketSize, so each probe comes back in one packet)",false,probeWords,"int", cmd);
+		cmd.parse(argc, argv);
+		ipAddress=ipAddressArg.getValue();
+		servIpAddress=servIpAddressArg.getValue();
+		configFname=configFnameArg.getValue();
+		rates=parseNumberList(ratesArg.getValue());
+		duration=durationArg.getValue();
+		probeWords=probeWordsArg.getValue();
+		blockName=parseInterface(interfaceArg.getValue());
+	} catch (TCLAP::ArgException &e) {
+		std::cerr << "Error: " << e.error() << " for argument " << e.argId() << std::endl;
+	}
+
+	ODILEServer server(ipAddress);
+	server.readConfigData(configFname);
+	server.sendConfigData();
+	sleep(1); //Give the ODILE a second to clear it's previous configuration
+
+	double sustainable=-1;
+	long corrupt=0;
+	for (unsigned int i=0; i < rates.size(); i++) {
+		loopback_stats_t stats=server.measureLoopback(blockName, duration, rates[i]*1e6/32, probeWords, servIpAddress);
+		long lost=stats.probes_sent-stats.probes_received-stats.probes_corrupt;
+		double echoGbps=stats.seconds > 0 ? stats.words_received*32e-9/stats.seconds : 0;
+		std::cout << "Rate " << rates[i] << " Mbit/s: " << stats.probes_sent << " probes sent, " << stats.probes_received << " echoed intact, "
+			  << stats.probes_corrupt << " corrupted (" << stats.words_skipped << " words skipped), " << lost << " lost; echo "
+			  << echoGbps << " Gbit/s" << std::endl;
+		if (stats.probes_received > 0) {
+			std::cout << "  Round trip: min " << stats.min_us << " us, median " << stats.median_us << " us, 90% " << stats.p90_us
+				  << " us, 99% " << stats.p99_us << " us, 99.9% " << stats.p999_us << " us, max " << stats.max_us << " us" << std::endl;
+		}
+		corrupt+=stats.probes_corrupt;
+		if (stats.probes_sent > 0 && lost==0 && stats.probes_corrupt==0 && echoGbps > sustainable) {
+			sustainable=echoGbps;
+		}
+	}
+	if (sustainable < 0) {
+		std::cout << "No rate came back without losses or corrupted probes." << std::endl;
+		return 1;
+	}
+	std::cout << "Highest echo bandwidth without losses: " << sustainable << " Gbit/s" << std::endl;
+	if (corrupt > 0) {
+		std::cout << "FAIL: " << corrupt << " probes came back corrupted." << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -24,6 +24,9 @@ int main (int argc, char *argv[]) {
 	int prefix=0;
 	bool waitResponse=false;
 	bool enableDebug=false;
+	int latencyCount=0;
+	int busyPollUs=0;
+	bool filterSource=false;
 	try {
 		TCLAP::CmdLine cmd("Standalone C++ program to send commands to an ODILE board over Ethernet", ' ', "0.1");
 		TCLAP::ValueArg<std::string> ipAddressArg("i", "ip","IP address of ODILE to send command to", false, ipAddress, "string",cmd);
@@ -33,6 +36,9 @@ int main (int argc, char *argv[]) {
 		TCLAP::SwitchArg waitResponseArg("r","response", "Wait for response from ODILE. Will print out simple responses to commands such as 'INV' if the command is invalid.", cmd, waitResponse);
 		TCLAP::ValueArg<int> prefixArg("p", "prefix","8-bit command prefix. Allows sending 8-bit prefixes to the 24-bit commands. Used for some commands to pass in additional parameters for the command.",false, prefix, "uint8_t",cmd);
 		TCLAP::ValueArg<uint32_t> secondWordArg("w","second","second word to send with command. Sends a second 32-bit word after the command, used with some commands to pass in additional parameters.",false, secondWord, "uint32_t", cmd);
+		TCLAP::ValueArg<int> latencyArg("l","latency","Send the command this many times, waiting for each reply, and print the round-trip times",false, latencyCount, "int", cmd);
+		TCLAP::ValueArg<int> busyPollArg("b","busypoll","Busy-poll the reply socket for this many microseconds per receive instead of sleeping in select()",false, busyPollUs, "int", cmd);
+		TCLAP::SwitchArg filterArg("F","filter","Have the kernel drop datagrams on the reply socket that don't come from the board",cmd,false);
 		cmd.parse(argc, argv);
 		ipAddress=ipAddressArg.getValue();
 		enableDebug=enableDebugArg.getValue();
@@ -41,10 +47,28 @@ int main (int argc, char *argv[]) {
 		outFname=outFnameArg.getValue();
 		prefix=prefixArg.getValue();
 		secondWord=secondWordArg.getValue();
+		latencyCount=latencyArg.getValue();
+		busyPollUs=busyPollArg.getValue();
+		filterSource=filterArg.getValue();
 	} catch (TCLAP::ArgException &e) {
 		std::cerr << "Error: " << e.error() << " for argument " << e.argId() << std::endl;
 	}
 	ODILEServer server(ipAddress);
+	server.setBusyPoll(busyPollUs);
+	server.setSourceFilter(filterSource);
+	if (latencyCount > 0) {
+		latency_stats_t latency=server.measureCommandLatency(command, latencyCount);
+		std::cout << (busyPollUs > 0 ? "Busy-poll" : "select()") << " round trip over " << latency.count << " replies: min " << latency.min_us
+							<< " us, median " << latency.median_us << " us, mean " << latency.mean_us << " us, max " << latency.max_us << " us";
+		if (latency.timeouts > 0) {
+			std::cout << " (" << latency.timeouts << " timed out)";
+		}
+		std::cout << std::endl;
+		if (filterSource) {
+			std::cout << "Filtered out " << server.getFilteredPackets() << " stray datagrams." << std::endl;
+		}
+		return 0;
+	}
 	// if (ODILEServer::stringToCommand(command) == INV ) {
 	// 	std::cout << "Error, command not valid" << std::endl;
 	// 	return 1;
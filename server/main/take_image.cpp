@@ -24,6 +24,8 @@ int main (int argc, char *argv[]) {
 	short nskips=1;
 	bool odileAvgSkips=false;
 	int nTrigSamps=-1;
+	async_opts_t asyncOpts;
+	std::vector<std::string> interfaces;
 	try {
 		TCLAP::CmdLine cmd("Standalone program to setup and read data from ODILE board for image acquisition.", ' ', "0.1");
 		TCLAP::ValueArg<std::string> ipAddressArg("i", "ip","IP address of ODILE", false, ipAddress, "string",cmd);
@@ -36,6 +38,23 @@ int main (int argc, char *argv[]) {
 		TCLAP::ValueArg<short> nskipsArg("k","nskips","Number of NDCMs (only added to header)",false, nskips,"short",cmd);
 		TCLAP::SwitchArg odileAvgSkipsArg("a","oaskip","Set ODILE to average over number of skips set by nskips parameter",cmd, odileAvgSkips);
 		TCLAP::ValueArg<int> nTrigSampsArg("S","samps","Number of samples per trigger to average over",false,nTrigSamps,"uint16_t", cmd);
+		TCLAP::ValueArg<int> batchSizeArg("b","batch","Number of packets to receive per system call",false,asyncOpts.batch_size,"int", cmd);
+		TCLAP::ValueArg<int> timeoutArg("t","timeout","Receive timeout (in ms) of the acquisition thread",false,asyncOpts.timeout_ms,"int", cmd);
+		TCLAP::ValueArg<int> rcvbufArg("R","rcvbuf","Kernel receive buffer size in bytes (0 uses the system default)",false,asyncOpts.rcvbuf_bytes,"int", cmd);
+		TCLAP::ValueArg<int> ringSlotsArg("q","ring","Number of packets buffered between the receive and disk writer threads (0 writes from the receive thread)",false,asyncOpts.ring_slots,"int", cmd);
+		TCLAP::ValueArg<std::string> backendArg("B","backend","Receive backend: udp (kernel UDP sockets), packet (raw AF_PACKET ring, needs CAP_NET_RAW) uring (io_uring, falls back to udp) or xdp (AF_XDP, needs CAP_NET_RAW and CAP_BPF)",false,"udp","string", cmd);
+		TCLAP::ValueArg<std::string> interfaceArg("I","interface","Network interface for the packet and xdp backends (default: the one holding the PC IP address)",false,"","string", cmd);
+		TCLAP::SwitchArg trackSeqArg("Q","seq","Strip the application header (ENET_HeaderConfig bit 3) from each packet and report lost, duplicated and reordered frames",cmd,false);
+		TCLAP::ValueArg<int> busyPollArg("y","busypoll","Busy-poll the udp backend's sockets for this many microseconds per receive instead of sleeping in select()",false,asyncOpts.busy_poll_us,"int", cmd);
+		TCLAP::SwitchArg groArg("G","gro","Let the kernel coalesce the udp backend's datagrams (UDP_GRO) into buffers of up to 64 KB, written in one go",cmd,false);
+		TCLAP::SwitchArg filterArg("F","filter","Have the kernel drop datagrams that don't come from the board interface's configured IP address and port (udp and uring backends)",cmd,false);
+		TCLAP::SwitchArg timestampsArg("T","timestamps","Timestamp packets in the kernel and report histograms of the packet inter-arrival gaps and of the kernel to receive thread delays (udp and packet backends)",cmd,false);
+		TCLAP::ValueArg<std::string> cpusArg("C","cpus","CPUs to run the receive threads on, e.g. 2-3 (default: any, or the NUMA node's)",false,"","string", cmd);
+		TCLAP::ValueArg<std::string> writerCpusArg("W","wcpus","CPUs to run the writer threads on",false,"","string", cmd);
+		TCLAP::ValueArg<int> priorityArg("P","prio","SCHED_FIFO priority of the receive threads (1-99, 0 for the normal scheduler)",false,0,"int", cmd);
+		TCLAP::SwitchArg lockArg("L","lock","Lock the receive buffers in memory (mlockall)",cmd,false);
+		TCLAP::ValueArg<std::string> numaArg("N","numa","NUMA node to run and allocate buffers on, or nic for the node of the receive interface",false,"","string", cmd);
+		TCLAP::MultiArg<std::string> multiArg("M","multi","Read the FIFOs enabled on this interface (sfp0, sfp1 or rj45) at the same time as those of the other -M interfaces, and merge them by sequence number (ignores -p, needs the application header)",false,"string", cmd);
 		cmd.parse(argc, argv);
 		ipAddress=ipAddressArg.getValue();
 		servIpAddress=servIpAddressArg.getValue();
@@ -47,6 +66,47 @@ int main (int argc, char *argv[]) {
 		nskips=nskipsArg.getValue();
 		odileAvgSkips=odileAvgSkipsArg.getValue();
 		nTrigSamps=nTrigSampsArg.getValue();
+		asyncOpts.batch_size=batchSizeArg.getValue();
+		asyncOpts.timeout_ms=timeoutArg.getValue();
+		asyncOpts.rcvbuf_bytes=rcvbufArg.getValue();
+		asyncOpts.ring_slots=ringSlotsArg.getValue();
+		if (backendArg.getValue()=="packet") {
+			asyncOpts.backend=BACKEND_PACKET;
+		} else if (backendArg.getValue()=="uring") {
+			asyncOpts.backend=BACKEND_URING;
+		} else if (backendArg.getValue()=="xdp") {
+			asyncOpts.backend=BACKEND_XDP;
+		} else if (backendArg.getValue()!="udp") {
+			std::cerr << "Unknown backend " << backendArg.getValue() << ", using udp." << std::endl;
+		}
+		asyncOpts.interface=interfaceArg.getValue();
+		asyncOpts.track_sequence=trackSeqArg.getValue();
+		asyncOpts.busy_poll_us=busyPollArg.getValue();
+		asyncOpts.timestamps=timestampsArg.getValue();
+		asyncOpts.gro=groArg.getValue();
+		asyncOpts.filter_source=filterArg.getValue();
+		asyncOpts.receive_policy.cpus=parseCpuList(cpusArg.getValue());
+		asyncOpts.receive_policy.rt_priority=priorityArg.getValue();
+		asyncOpts.receive_policy.lock_memory=lockArg.getValue();
+		asyncOpts.writer_policy.cpus=parseCpuList(writerCpusArg.getValue());
+		if (numaArg.getValue()=="nic") {
+			asyncOpts.receive_policy.numa_node=NUMA_NODE_NIC;
+		} else if (!numaArg.getValue().empty()) {
+			asyncOpts.receive_policy.numa_node=atoi(numaArg.getValue().c_str());
+		}
+		asyncOpts.writer_policy.numa_node=asyncOpts.receive_policy.numa_node;
+		for (unsigned int i=0; i < multiArg.getValue().size(); i++) {
+			std::string name=multiArg.getValue()[i];
+			if (name=="sfp0") {
+				interfaces.push_back("SFP0ConfigBlock");
+			} else if (name=="sfp1") {
+				interfaces.push_back("SFP1ConfigBlock");
+			} else if (name=="rj45") {
+				interfaces.push_back("RJ45ConfigBlock");
+			} else {
+				std::cerr << "Unknown interface " << name << ", ignoring it." << std::endl;
+			}
+		}
 
 	} catch (TCLAP::ArgException &e) {
 		std::cerr << "Error: " << e.error() << " for argument " << e.argId() << std::endl;
@@ -76,16 +136,68 @@ int main (int argc, char *argv[]) {
 	int npix=server.getWordsToRead(nrows,ncols,nskips);
 	//If we don't average over skips on the ODILE, need to make the .fits file wider
 	int fits_cols=npix/nrows;
-	int threadID=server.launchAsyncThread(imageFname,servIpAddress,port,nrows, fits_cols);
+	//A merged session reads all the FIFOs enabled on the -M interfaces, otherwise one thread reads the given port
+	int sessionID=-1;
+	std::vector<int> threadIDs;
+	if (!interfaces.empty()) {
+		std::vector<int> ports=server.configBlocks.getDataPorts(interfaces);
+		std::cout << "Merging " << ports.size() << " ports:";
+		for (unsigned int i=0; i < ports.size(); i++) {
+			std::cout << " 0x" << std::hex << ports[i] << std::dec;
+		}
+		std::cout << std::endl;
+		sessionID=server.launchSession(imageFname,servIpAddress,ports,nrows, fits_cols, asyncOpts);
+		threadIDs=server.getSessionThreads(sessionID);
+	} else {
+		threadIDs.push_back(server.launchAsyncThread(imageFname,servIpAddress,port,nrows, fits_cols, asyncOpts));
+	}
 	std::cout << "Reading " << npix << " samples." << std::endl;
 	int npixRead=0;
+	int npackDropped=0;
+	ring_stats_t ringStats;
+	double cpuSeconds=0;
 	while (npixRead<npix) {
 		sleep(1);
-		npixRead = server.getWordsRead(threadID);		
+		if (sessionID >= 0) {
+			npixRead = server.getMergeStats(sessionID).words;
+		} else {
+			npixRead = server.getWordsRead(threadIDs[0]);
+		}
+		npackDropped = 0;
+		for (unsigned int i=0; i < threadIDs.size(); i++) {
+			int ndropped = server.getPacketsDropped(threadIDs[i]);
+			if (ndropped > 0) npackDropped += ndropped;
+		}
+		ringStats = server.getRingStats(threadIDs[0]);
+		cpuSeconds = server.getCpuSeconds(threadIDs[0]);
 		print_progress(npixRead*1.0/npix);
 	}
+	//Closing a session frees its threads' histograms
+	std::vector<histogram_t> arrivalGaps, kernelDelays;
+	for (unsigned int i=0; asyncOpts.timestamps && i < threadIDs.size(); i++) {
+		arrivalGaps.push_back(server.getArrivalGaps(threadIDs[i]));
+		kernelDelays.push_back(server.getKernelDelays(threadIDs[i]));
+	}
+	if (sessionID >= 0) {
+		//The merger has to finish the file before we add the header
+		npixRead = server.closeSession(sessionID);
+	}
 	//Placeholder
 	std::string ctime=server.getCompileTimeStr();
 	server.writeFitsHeader(imageFname, nskips, "L", 5, 100, ctime);
 	std::cout <<std::endl <<  "Read a total of " << npixRead << " words." << std::endl;
+	std::cout << "Host dropped " << npackDropped << " packets." << std::endl;
+	if (ringStats.capacity > 0) {
+		std::cout << "Writer ring peaked at " << ringStats.high_water << "/" << ringStats.capacity << " packets, stalled "
+							<< ringStats.stalls << " times (" << ringStats.stall_ms << " ms)." << std::endl;
+	}
+	if (npixRead > 0) {
+		std::cout << "Used " << cpuSeconds << " s of CPU (" << cpuSeconds/(npixRead*32.0e-9) << " s per Gbit received)." << std::endl;
+	}
+	for (unsigned int i=0; i < arrivalGaps.size(); i++) {
+		std::cout << "Thread " << threadIDs[i] << " packet inter-arrival gaps: ";
+		arrivalGaps[i].report(std::cout, "us", 1000);
+		std::cout << "Thread " << threadIDs[i] << " kernel to receive thread delays: ";
+		kernelDelays[i].report(std::cout, "us", 1000);
+	}
 };
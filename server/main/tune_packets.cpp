@@ -0,0 +1,170 @@
+#include "ODILEServer.hpp"
+#include "PacketSocket.hpp"
+#include "ToolOptions.hpp"
+#include <vector>
+#include <unistd.h>
+
+#define TCLAP_SETBASE_ZERO 1
+#include "tclap/CmdLine.h"
+
+using namespace udp_client_server;
+
+//Result of streaming with one setting
+struct tune_result_t {
+	uint16_t packet_size;
+	uint16_t fifo_flags;
+	int nfifos;
+	double gbps;
+	//Fraction of the frames lost (missing from the sequence, on the link or in the host kernel)
+	double loss;
+	//Seconds of CPU per Gbit received
+	double cpu_per_gbit;
+};
+
+//Parses a comma separated list of settings (decimal, or hex with 0x)
+std::vector<uint16_t> parseSettings(std::string list) {
+	std::vector<double> values=parseNumberList(list);
+	return std::vector<uint16_t>(values.begin(), values.end());
+}
+
+//True if a is a better setting than b: lossless before lossy, then the highest throughput (within 2%), then the least CPU per Gbit
+bool better(const tune_result_t &a, const tune_result_t &b) {
+	if ((a.loss==0) != (b.loss==0)) return a.loss==0;
+	if (a.loss > 0 && a.loss != b.loss) return a.loss < b.loss;
+	if (a.gbps > b.gbps*1.02) return true;
+	if (b.gbps > a.gbps*1.02) return false;
+	return a.cpu_per_gbit < b.cpu_per_gbit;
+}
+
+int main (int argc, char *argv[]) {
+	//Parse command line arguments
+	std::string ipAddress="192.168.0.3";
+	std::string servIpAddress="192.168.0.1";
+	std::string configFname="config.ini";
+	std::string outFname="/dev/shm/tune_packets.bin";
+	std::string iniFname="";
+	std::string blockName="RJ45ConfigBlock";
+	std::vector<uint16_t> packetSizes;
+	std::vector<uint16_t> fifoFlags;
+	int duration=3;
+	int warmup=1;
+	int speed=0;
+	async_opts_t asyncOpts;
+	try {
+		TCLAP::CmdLine cmd("Sweeps the packet size and FIFO flags of an ODILE Ethernet interface, streaming test counters with each setting, and recommends the one with the best throughput, loss and CPU use on this host.", ' ', "0.1");
+		TCLAP::ValueArg<std::string> ipAddressArg("i", "ip","IP address of ODILE", false, ipAddress, "string",cmd);
+		TCLAP::ValueArg<std::string> servIpAddressArg("s", "sip","IP address of PC", false, servIpAddress, "string",cmd);
+		TCLAP::ValueArg<std::string> configFnameArg("c","config","Configuration file to start from", false, configFname, "string",cmd);
+		TCLAP::ValueArg<std::string> outFnameArg("f", "file","Output file the data is written to while streaming (one per FIFO, deleted after each setting)", false, outFname, "string",cmd);
+		TCLAP::ValueArg<std::string> iniFnameArg("w", "write","Write the configuration with the recommended setting to this INI file", false, iniFname, "string",cmd);
+		TCLAP::ValueArg<std::string> interfaceArg("I","interface","Ethernet interface to tune: sfp0, sfp1 or rj45",false,"rj45","string", cmd);
+		TCLAP::ValueArg<std::string> sizesArg("P","sizes","Packet sizes (ENET_PacketSize, in words) to try",false,"128,256,512,1024,2048","string", cmd);
+		TCLAP::ValueArg<std::string> flagsArg("F","flags","FIFO enable/priority flags (ENET_FIFO, 2 bits per FIFO) to try",false,"0x1,0x5,0x55,0x555","string", cmd);
+		TCLAP::ValueArg<int> durationArg("d","duration","Seconds to stream with each setting",false,duration,"int", cmd);
+		TCLAP::ValueArg<int> warmupArg("u","warmup","Seconds to stream before measuring",false,warmup,"int", cmd);
+		TCLAP::ValueArg<int> speedArg("k","speed","Counter speed (0 writes a word every clock cycle, up to 255)",false,speed,"int", cmd);
+		TCLAP::ValueArg<std::string> backendArg("B","backend","Receive backend: udp, packet, uring or xdp (see take_image)",false,"udp","string", cmd);
+		TCLAP::ValueArg<int> batchSizeArg("b","batch","Number of packets to receive per system call",false,asyncOpts.batch_size,"int", cmd);
+		TCLAP::ValueArg<int> rcvbufArg("R","rcvbuf","Kernel receive buffer size in bytes (0 uses the system default)",false,asyncOpts.rcvbuf_bytes,"int", cmd);
+		TCLAP::ValueArg<std::string> cpusArg("C","cpus","CPUs to run the receive threads on, e.g. 2-3",false,"","string", cmd);
+		cmd.parse(argc, argv);
+		ipAddress=ipAddressArg.getValue();
+		servIpAddress=servIpAddressArg.getValue();
+		configFname=configFnameArg.getValue();
+		outFname=outFnameArg.getValue();
+		iniFname=iniFnameArg.getValue();
+		packetSizes=parseSettings(sizesArg.getValue());
+		fifoFlags=parseSettings(flagsArg.getValue());
+		duration=durationArg.getValue();
+		warmup=warmupArg.getValue();
+		speed=speedArg.getValue();
+		blockName=parseInterface(interfaceArg.getValue());
+		asyncOpts.backend=parseBackend(backendArg.getValue());
+		asyncOpts.batch_size=batchSizeArg.getValue();
+		asyncOpts.rcvbuf_bytes=rcvbufArg.getValue();
+		asyncOpts.receive_policy.cpus=parseCpuList(cpusArg.getValue());
+	} catch (TCLAP::ArgException &e) {
+		std::cerr << "Error: " << e.error() << " for argument " << e.argId() << std::endl;
+	}
+	//Loss is counted from the frame sequence numbers
+	asyncOpts.track_sequence=true;
+
+	ODILEServer server(ipAddress);
+	server.readConfigData(configFname);
+	ConfigRegisterBlock &block=server.configBlocks.getBlock(blockName);
+	uint16_t headerConfig=block.getConfigEntry("ENET_HeaderConfig").value;
+	uint16_t counterConfig=block.getConfigEntry("ENET_CounterEnable").value;
+	uint16_t packetSizeConfig=block.getConfigEntry("ENET_PacketSize").value;
+	uint16_t fifoConfig=block.getConfigEntry("ENET_FIFO").value;
+	server.setHeaderConfig(blockName, headerConfig | HEADER_CONFIG_APP);
+
+	std::vector<tune_result_t> results;
+	for (unsigned int f=0; f < fifoFlags.size(); f++) {
+		//The counters run on the enabled FIFOs only
+		uint8_t fifoMask=0;
+		for (int i=0; i < 4; i++) {
+			if (fifoFlags[f] & (1 << 2*i)) fifoMask|=1 << i;
+		}
+		for (unsigned int p=0; p < packetSizes.size(); p++) {
+			tune_result_t result;
+			result.packet_size=packetSizes[p];
+			result.fifo_flags=fifoFlags[f];
+			result.nfifos=__builtin_popcount(fifoMask);
+			server.setPacketSize(blockName, packetSizes[p]);
+			server.setFifoFlags(blockName, fifoFlags[f]);
+			server.setCounters(blockName, fifoMask, speed);
+			server.sendConfigData();
+			sleep(1); //Give the ODILE a second to clear it's previous configuration
+			int groupID=server.launchGroup(outFname, servIpAddress, blockName, -1, -1, asyncOpts);
+			if (groupID < 0) continue;
+			sleep(warmup);
+			group_stats_t start=server.getGroupStats(groupID);
+			double tstart=monotonicSeconds();
+			sleep(duration);
+			group_stats_t end=server.getGroupStats(groupID);
+			double elapsed=monotonicSeconds()-tstart;
+			std::vector<std::string> files=server.getGroupFiles(groupID);
+			server.closeGroup(groupID);
+			for (unsigned int i=0; i < files.size(); i++) {
+				unlink(files[i].c_str());
+			}
+			double gbits=(end.words-start.words)*32e-9;
+			long frames=end.sequence.frames-start.sequence.frames;
+			//Datagrams the kernel dropped show up as gaps too
+			long missing=end.sequence.missing_frames-start.sequence.missing_frames;
+			result.gbps=gbits/elapsed;
+			result.loss=frames+missing > 0 ? double(missing)/(frames+missing) : 1;
+			result.cpu_per_gbit=gbits > 0 ? (end.cpu_seconds-start.cpu_seconds)/gbits : 0;
+			std::cout << "PacketSize " << result.packet_size << ", FIFO flags 0x" << std::hex << result.fifo_flags << std::dec
+				  << " (" << result.nfifos << " FIFOs): " << result.gbps << " Gbit/s, loss " << result.loss*100 << "%, "
+				  << result.cpu_per_gbit << " s of CPU per Gbit" << std::endl;
+			results.push_back(result);
+		}
+	}
+
+	//Put the data back on the FIFOs, with the settings we started from
+	server.setCounters(blockName, counterConfig & 0x1F, counterConfig >> 8);
+	server.setHeaderConfig(blockName, headerConfig);
+	server.setPacketSize(blockName, packetSizeConfig);
+	server.setFifoFlags(blockName, fifoConfig);
+	server.sendConfigData();
+	if (results.empty()) {
+		std::cout << "No setting could be measured." << std::endl;
+		return -1;
+	}
+	tune_result_t best=results[0];
+	for (unsigned int i=1; i < results.size(); i++) {
+		if (better(results[i], best)) best=results[i];
+	}
+	std::cout << "Recommended: ENET_PacketSize = " << best.packet_size << ", ENET_FIFO = 0x" << std::hex << best.fifo_flags << std::dec
+		  << " (" << best.gbps << " Gbit/s, loss " << best.loss*100 << "%)" << std::endl;
+	if (!iniFname.empty()) {
+		server.setPacketSize(blockName, best.packet_size);
+		server.setFifoFlags(blockName, best.fifo_flags);
+		server.configBlocks.writeINI(iniFname);
+		std::cout << "Wrote " << iniFname << std::endl;
+	}
+	std::cout << "The board is back on ENET_PacketSize = " << packetSizeConfig << ", ENET_FIFO = 0x" << std::hex << fifoConfig << std::dec
+		  << " from " << configFname << "." << std::endl;
+	return 0;
+}
@@ -0,0 +1,136 @@
+#include "ODILEServer.hpp"
+#include "PacketSocket.hpp"
+#include "ToolOptions.hpp"
+#include <vector>
+#include <unistd.h>
+
+#define TCLAP_SETBASE_ZERO 1
+#include "tclap/CmdLine.h"
+
+using namespace udp_client_server;
+
+int main (int argc, char *argv[]) {
+	//Parse command line arguments
+	std::string ipAddress="192.168.0.3";
+	std::string servIpAddress="192.168.0.1";
+	std::string configFname="config.ini";
+	std::string outFname="/dev/shm/validate_link.bin";
+	std::string blockName="RJ45ConfigBlock";
+	int fifoFlags=-1;
+	int packetSize=-1;
+	int duration=10;
+	int nrounds=1;
+	int speed=0;
+	async_opts_t asyncOpts;
+	try {
+		TCLAP::CmdLine cmd("Link burn-in test: streams the test counters of the FIFOs of an ODILE Ethernet interface and checks every word received, telling the words the board lost from the frames lost on the way to the host.", ' ', "0.1");
+		TCLAP::ValueArg<std::string> ipAddressArg("i", "ip","IP address of ODILE", false, ipAddress, "string",cmd);
+		TCLAP::ValueArg<std::string> servIpAddressArg("s", "sip","IP address of PC", false, servIpAddress, "string",cmd);
+		TCLAP::ValueArg<std::string> configFnameArg("c","config","Configuration file to use", false, configFname, "string",cmd);
+		TCLAP::ValueArg<std::string> outFnameArg("f", "file","Output file the data is written to (one per FIFO, deleted after each round)", false, outFname, "string",cmd);
+		TCLAP::ValueArg<std::string> interfaceArg("I","interface","Ethernet interface to test: sfp0, sfp1 or rj45",false,"rj45","string", cmd);
+		TCLAP::ValueArg<int> flagsArg("F","flags","FIFO enable/priority flags (ENET_FIFO) to test with (default: from the configuration)",false,fifoFlags,"int", cmd);
+		TCLAP::ValueArg<int> packetSizeArg("P","size","Packet size (ENET_PacketSize, in words) to test with (default: from the configuration)",false,packetSize,"int", cmd);
+		TCLAP::ValueArg<int> durationArg("d","duration","Seconds to stream in each round",false,duration,"int", cmd);
+		TCLAP::ValueArg<int> roundsArg("r","rounds","Number of rounds, each checked from scratch",false,nrounds,"int", cmd);
+		TCLAP::ValueArg<int> speedArg("k","speed","Counter speed (0 writes a word every clock cycle, up to 255)",false,speed,"int", cmd);
+		TCLAP::ValueArg<std::string> backendArg("B","backend","Receive backend: udp, packet, uring or xdp (see take_image)",false,"udp","string", cmd);
+		TCLAP::ValueArg<int> batchSizeArg("b","batch","Number of packets to receive per system call",false,asyncOpts.batch_size,"int", cmd);
+		TCLAP::ValueArg<int> rcvbufArg("R","rcvbuf","Kernel receive buffer size in bytes (0 uses the system default)",false,asyncOpts.rcvbuf_bytes,"int", cmd);
+		TCLAP::ValueArg<std::string> cpusArg("C","cpus","CPUs to run the receive threads on, e.g. 2-3",false,"","string", cmd);
+		cmd.parse(argc, argv);
+		ipAddress=ipAddressArg.getValue();
+		servIpAddress=servIpAddressArg.getValue();
+		configFname=configFnameArg.getValue();
+		outFname=outFnameArg.getValue();
+		fifoFlags=flagsArg.getValue();
+		packetSize=packetSizeArg.getValue();
+		duration=durationArg.getValue();
+		nrounds=roundsArg.getValue();
+		speed=speedArg.getValue();
+		blockName=parseInterface(interfaceArg.getValue());
+		asyncOpts.backend=parseBackend(backendArg.getValue());
+		asyncOpts.batch_size=batchSizeArg.getValue();
+		asyncOpts.rcvbuf_bytes=rcvbufArg.getValue();
+		asyncOpts.receive_policy.cpus=parseCpuList(cpusArg.getValue());
+	} catch (TCLAP::ArgException &e) {
+		std::cerr << "Error: " << e.error() << " for argument " << e.argId() << std::endl;
+	}
+	//The sequence numbers tell the frames lost by the host from the words lost by the board
+	asyncOpts.track_sequence=true;
+	asyncOpts.check_counters=true;
+
+	ODILEServer server(ipAddress);
+	server.readConfigData(configFname);
+	ConfigRegisterBlock &block=server.configBlocks.getBlock(blockName);
+	uint16_t headerConfig=block.getConfigEntry("ENET_HeaderConfig").value;
+	uint16_t counterConfig=block.getConfigEntry("ENET_CounterEnable").value;
+	uint16_t packetSizeConfig=block.getConfigEntry("ENET_PacketSize").value;
+	uint16_t fifoConfig=block.getConfigEntry("ENET_FIFO").value;
+	if (fifoFlags >= 0) {
+		server.setFifoFlags(blockName, fifoFlags);
+	}
+	if (packetSize > 0) {
+		server.setPacketSize(blockName, packetSize);
+	}
+	//Run the counters on the enabled FIFOs
+	uint16_t flags=block.getConfigEntry("ENET_FIFO").value;
+	uint8_t fifoMask=0;
+	for (int i=0; i < 4; i++) {
+		if (flags & (1 << 2*i)) fifoMask|=1 << i;
+	}
+	server.setHeaderConfig(blockName, headerConfig | HEADER_CONFIG_APP);
+	server.setCounters(blockName, fifoMask, speed);
+	server.sendConfigData();
+	sleep(1); //Give the ODILE a second to clear it's previous configuration
+
+	long totalErrors=0;
+	long totalHostGaps=0;
+	for (int round=0; round < nrounds; round++) {
+		//Each round checks from the first word its threads receive, wherever the counters are by then
+		int groupID=server.launchGroup(outFname, servIpAddress, blockName, -1, -1, asyncOpts);
+		if (groupID < 0) break;
+		double tstart=monotonicSeconds();
+		sleep(duration);
+		double elapsed=monotonicSeconds()-tstart;
+		std::vector<int> threadIDs=server.getGroupThreads(groupID);
+		std::vector<std::string> files=server.getGroupFiles(groupID);
+		std::vector<counter_stats_t> counterStats;
+		std::vector<seq_stats_t> seqStats;
+		for (unsigned int i=0; i < threadIDs.size(); i++) {
+			counterStats.push_back(server.getCounterStats(threadIDs[i]));
+			seqStats.push_back(server.getSequenceStats(threadIDs[i]));
+		}
+		server.closeGroup(groupID);
+		for (unsigned int i=0; i < files.size(); i++) {
+			unlink(files[i].c_str());
+		}
+		std::cout << "Round " << round+1 << "/" << nrounds << ":" << std::endl;
+		for (unsigned int i=0; i < counterStats.size(); i++) {
+			const counter_stats_t &stats=counterStats[i];
+			std::cout << "  " << files[i] << ": " << stats.words*32e-9/elapsed << " Gbit/s, " << stats.words << " words, "
+				  << stats.errors << " errors (" << stats.skipped_words << " words skipped by the board), "
+				  << seqStats[i].missing_frames << " frames lost by the host";
+			if (stats.first_error_offset >= 0) {
+				std::cout << ", first error at word " << stats.first_error_offset << " (expected 0x" << std::hex << stats.first_expected
+					  << ", received 0x" << stats.first_received << std::dec << ")";
+			}
+			std::cout << std::endl;
+			totalErrors+=stats.errors;
+			totalHostGaps+=seqStats[i].missing_frames;
+		}
+	}
+
+	//Put the data back on the FIFOs, with the settings we started from (also after a group failed to launch)
+	server.setCounters(blockName, counterConfig & 0x1F, counterConfig >> 8);
+	server.setHeaderConfig(blockName, headerConfig);
+	server.setPacketSize(blockName, packetSizeConfig);
+	server.setFifoFlags(blockName, fifoConfig);
+	server.sendConfigData();
+	if (totalErrors==0 && totalHostGaps==0) {
+		std::cout << "PASS" << std::endl;
+		return 0;
+	}
+	std::cout << "FAIL: " << totalErrors << " counter errors on the board side, " << totalHostGaps << " frames lost by the host." << std::endl;
+	return 1;
+}
@@ -3,6 +3,7 @@
 #include "udp_client_server.h"
 #include "INIReader.h"
 #include <fstream>
+#include <cstring>
 
 #define TCLAP_SETBASE_ZERO 1
 #include "tclap/CmdLine.h"
@@ -15,21 +16,45 @@ int main (int argc, char *argv[]) {
 	std::string inFname="";
 	bool enableDebug=false;
 	int port=0x2000;
+	int datagramWords=0;
+	bool useGso=false;
+	int mtu=DEFAULT_MTU;
 	try {
 		TCLAP::CmdLine cmd("Simple c++ program to write data to an ODILE board over Ethernet", ' ', "0.1");
 		TCLAP::ValueArg<std::string> ipAddressArg("i", "ip","IP address to send data to", false, ipAddress, "string",cmd);
 		TCLAP::ValueArg<std::string> inFnameArg("f", "file","Configuration file to read from", true, inFname, "string",cmd);
 		TCLAP::ValueArg<int> portArg("p","port","UDP port to send data to", false, port,"int",cmd);
 		TCLAP::SwitchArg enableDebugArg("d","debug", "Enable debug output", cmd,enableDebug);
+		TCLAP::ValueArg<int> datagramWordsArg("s","split","Split the data into datagrams of this many words, sent in batches. 0 splits it to the MTU.",false, datagramWords,"int",cmd);
+		TCLAP::ValueArg<int> mtuArg("m","mtu","MTU of the path to the board",false, mtu,"int",cmd);
+		TCLAP::SwitchArg gsoArg("G","gso","With -s, have the kernel split the data with UDP segmentation offload",cmd,false);
 		cmd.parse(argc, argv);
 		ipAddress=ipAddressArg.getValue();
 		inFname=inFnameArg.getValue();
 		enableDebug=enableDebugArg.getValue();
 		port=portArg.getValue();
+		datagramWords=datagramWordsArg.getValue();
+		useGso=gsoArg.getValue();
+		mtu=mtuArg.getValue();
 	} catch (TCLAP::ArgException &e) {
 		std::cerr << "Error: " << e.error() << " for argument " << e.argId() << std::endl;
 	}
 	ODILEServer server(ipAddress);
+	server.setMTU(mtu);
+	if (datagramWords > 0) {
+		std::vector<int> status=server.sendBulk(inFname, port, datagramWords, useGso);
+		int nfailed=0;
+		for (unsigned int i=0; i < status.size(); i++) {
+			if (status[i] < 0) {
+				if (nfailed==0) {
+					std::cout << "Datagram " << i << " failed: " << strerror(-status[i]) << std::endl;
+				}
+				nfailed++;
+			}
+		}
+		std::cout << "Sent " << status.size()-nfailed << " of " << status.size() << " datagrams." << std::endl;
+		return nfailed > 0 ? 1 : 0;
+	}
 	server.sendData(inFname, port);
 	
 	return 0;
@@ -6,6 +6,7 @@ Holds the master list of all configuration register blocks and registers.
 #include "INIReader.h"
 
 #include <fstream>
+#include <iostream>
 
 ConfigEntry UNUSED_CONFIG(char address) {
 	return ConfigEntry(0x0000, address, "UNUSED", "Unused");
@@ -256,4 +257,40 @@ ConfigRegisterBlock& ConfigBlockList::getBlock(std::string name) {
 		}
 	}
 };
-	
+
+/*
+  Returns the Ethernet interface block (SFP0, SFP1 or RJ45) that sends data to/receives data from a UDP port, or NULL if the port does not belong to any interface.
+  Each interface owns the ports from its base UDP address up to the base+7 (the low bits select the FIFO, see ethernet_data_block.vhd).
+*/
+ConfigRegisterBlock* ConfigBlockList::getEnetBlock(int port) {
+	//The first three blocks are the Ethernet interfaces, entry 0x0E holds their base UDP address
+	for (int i=0; i < 3; i++) {
+		if ((port & 0xFFF8) == blocks[i].config_entries[0x0E].value) {
+			return &blocks[i];
+		}
+	}
+	return NULL;
+};
+
+/*
+  Returns the UDP ports of the data FIFOs enabled (ENET_FIFO flag bit 0) on the named Ethernet interface blocks, e.g. {"SFP0ConfigBlock","SFP1ConfigBlock"}.
+  Every interface sends the same FIFO data, so a FIFO enabled on several of these interfaces is only read from the first one that enables it. To share a readout between links, enable a different set of FIFOs on each of them.
+*/
+std::vector<int> ConfigBlockList::getDataPorts(std::vector<std::string> block_names) {
+	std::vector<int> ports;
+	bool taken[ENET_DATA_FIFOS]={false};
+	for (unsigned int i=0; i < block_names.size(); i++) {
+		ConfigRegisterBlock &block=getBlock(block_names[i]);
+		uint16_t fifo_flags=block.getConfigEntry("ENET_FIFO").value;
+		for (int fifo=0; fifo < ENET_DATA_FIFOS; fifo++) {
+			if (((fifo_flags >> (2*fifo)) & 0x1)==0) continue;
+			if (taken[fifo]) {
+				std::cout << "FIFO " << fifo << " is enabled on more than one interface, reading it from the first only." << std::endl;
+				continue;
+			}
+			taken[fifo]=true;
+			ports.push_back(block.config_entries[0x0E].value | fifo);
+		}
+	}
+	return ports;
+};
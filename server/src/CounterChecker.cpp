@@ -0,0 +1,84 @@
+#include "CounterChecker.hpp"
+
+#include <arpa/inet.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+//Forward jumps of the count shorter than this are words skipped, longer ones are corrupted words
+#define COUNTER_HALF 0x80000000u
+
+CounterChecker::CounterChecker() : seen(false), next(0) {
+};
+
+void CounterChecker::check(const uint32_t *words, int nwords, bool host_gap) {
+  if (nwords <= 0) return;
+  long offset=stats.words;
+  if (!seen) {
+    //The counters run from the board's reset, not from the start of the receive
+    seen=true;
+    next=ntohl(words[0]);
+  };
+  //Only the first word can follow the frames the host lost
+  checkScalar(words, 0, 1, offset, host_gap);
+  int i=1;
+#ifdef __SSE2__
+  const __m128i step=_mm_set1_epi32(4);
+  __m128i expected=_mm_add_epi32(_mm_set1_epi32(next), _mm_set_epi32(3, 2, 1, 0));
+  for (; i+4 <= nwords; i+=4) {
+    __m128i received=_mm_loadu_si128((const __m128i *)(words+i));
+    //Network to host order: swap the bytes of each 16-bit half, then the halves
+    received=_mm_or_si128(_mm_slli_epi16(received, 8), _mm_srli_epi16(received, 8));
+    received=_mm_shufflelo_epi16(received, _MM_SHUFFLE(2, 3, 0, 1));
+    received=_mm_shufflehi_epi16(received, _MM_SHUFFLE(2, 3, 0, 1));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi32(received, expected))==0xFFFF) {
+      expected=_mm_add_epi32(expected, step);
+      continue;
+    };
+    //Find the break one word at a time, and restart the count from there
+    next=_mm_cvtsi128_si32(expected);
+    checkScalar(words, i, i+4, offset, false);
+    expected=_mm_add_epi32(_mm_set1_epi32(next), _mm_set_epi32(3, 2, 1, 0));
+  };
+  next=_mm_cvtsi128_si32(expected);
+#endif //__SSE2__
+  checkScalar(words, i, nwords, offset, false);
+  stats.words+=nwords;
+  published.publish(stats);
+};
+
+void CounterChecker::checkScalar(const uint32_t *words, int start, int end, long offset, bool host_gap) {
+  for (int i=start; i < end; i++) {
+    uint32_t received=ntohl(words[i]);
+    if (received != next) {
+      recordBreak(received, offset+i, host_gap);
+    };
+    next=received+1;
+  };
+};
+
+void CounterChecker::recordBreak(uint32_t received, long offset, bool host_gap) {
+  if (host_gap) {
+    stats.host_gaps++;
+    return;
+  };
+  stats.errors++;
+  uint32_t jump=received-next;
+  if (jump < COUNTER_HALF) {
+    stats.skipped_words+=jump;
+  };
+  if (stats.first_error_offset < 0) {
+    stats.first_error_offset=offset;
+    stats.first_expected=next;
+    stats.first_received=received;
+  };
+};
+
+void CounterChecker::report(std::ostream &out) const {
+  out << stats.words << " words checked, " << stats.errors << " errors (" << stats.skipped_words << " words skipped), "
+      << stats.host_gaps << " breaks at frames lost by the host." << std::endl;
+  if (stats.first_error_offset >= 0) {
+    out << "  First error at word " << stats.first_error_offset << ": expected 0x" << std::hex << stats.first_expected
+	<< ", received 0x" << stats.first_received << std::dec << std::endl;
+  };
+};
@@ -0,0 +1,99 @@
+#include "DataWriter.hpp"
+
+#include <byteswap.h>
+//To properly format hex to text files
+#include <iomanip>
+
+//Swaps byte ordering (little endian to big endian or vice versa)
+void swapBufferBytes(uint32_t *buffer, int nwords) {
+  for (int i=0; i < nwords; i++) {
+    buffer[i]=bswap_32(buffer[i]);
+  };
+}
+
+DataWriter::DataWriter() : write_fits(false), write_text(false), is_open(false) {
+#ifdef CFITSIO_INSTALLED
+  fFile=NULL;
+  fstatus=0;
+  curr_pix=1;
+  pix_to_read=0;
+#endif //CFITSIO_INSTALLED
+};
+
+DataWriter::~DataWriter() {
+  close();
+};
+
+/*
+  Opens the output file. nrows and ncols set the image size for .fits files, and are written at the start of binary files (if they make sense).
+*/
+void DataWriter::open(std::string fname, int nrows, int ncols) {
+  if (fname.find(".fits")!=std::string::npos &&
+      ncols>0 && nrows>0) {
+
+#ifdef CFITSIO_INSTALLED
+    //Create fits file and image
+    //TODO: make this handle errors in file creation
+    fits_create_file(&fFile, fname.c_str(), &fstatus);
+    long naxis=2;
+    long naxes[2]={ncols, nrows};
+    fits_create_img(fFile, LONG_IMG, naxis, naxes,&fstatus);
+    curr_pix=1;
+    pix_to_read=LONGLONG(nrows)*ncols;
+    write_fits=true;
+#endif //CFITSIO_INSTALLED
+
+  } else if (fname.find(".txt")!=std::string::npos) {
+    //Run in text output mode
+    outfile.open(fname, std::ios::out);
+    write_text=true;
+  } else {
+    //Write binary data
+    outfile.open(fname, std::ios::out | std::ios::binary);
+    //Start by writing the ncols and nrows parameters, if they make sense
+    if (ncols>0 && nrows>0) {
+      uint32_t nrows_word=bswap_32(nrows);
+      uint32_t ncols_word=bswap_32(ncols);
+      outfile.write((char *) &ncols_word, sizeof(uint32_t));
+      outfile.write((char *) &nrows_word, sizeof(uint32_t));
+    }
+  };
+  is_open=true;
+};
+
+void DataWriter::write(char *buffer, int nbytes) {
+  int nwords=nbytes/4;
+  if (write_fits) {
+#ifdef CFITSIO_INSTALLED
+    if (curr_pix <= pix_to_read) {
+      swapBufferBytes((uint32_t*)buffer, nwords);
+      fits_write_img(fFile, TINT, curr_pix, LONGLONG(nwords), buffer, &fstatus);
+      curr_pix+=LONGLONG(nwords);
+    }
+#endif //CFITSIO_INSTALLED
+  } else if (write_text) {
+    for (int i=0; i < nwords; i++) {
+      uint32_t word=((uint32_t*)buffer)[i];
+      outfile << std::hex <<std::setw(8) << std::setfill('0') << bswap_32(word) << std::endl;
+    }
+  } else {
+    outfile.write(buffer, nbytes);
+  };
+};
+
+long DataWriter::tell() {
+  outfile.flush();
+  return outfile.tellp();
+};
+
+void DataWriter::close() {
+  if (!is_open) return;
+  if (write_fits) {
+#ifdef CFITSIO_INSTALLED
+    fits_close_file(fFile, &fstatus);
+#endif
+  } else {
+    outfile.close();
+  }
+  is_open=false;
+};
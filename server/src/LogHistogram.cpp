@@ -0,0 +1,59 @@
+#include "LogHistogram.hpp"
+
+histogram_t::histogram_t() : count(0), total(0), max(0) {
+  for (int i=0; i < LOG_HISTOGRAM_BUCKETS; i++) {
+    buckets[i]=0;
+  };
+};
+
+uint64_t histogram_t::percentile(double fraction) const {
+  uint64_t target=uint64_t(fraction*count);
+  uint64_t seen=0;
+  for (int i=0; i < LOG_HISTOGRAM_BUCKETS; i++) {
+    seen+=buckets[i];
+    if (seen > target) {
+      uint64_t edge=i==0 ? 0 : (i < 64 ? (1ULL << i)-1 : max);
+      return edge < max ? edge : max;
+    };
+  };
+  return max;
+};
+
+void histogram_t::report(std::ostream &out, std::string unit, double scale) const {
+  out << count << " values, mean " << mean()/scale << " " << unit << ", median < " << percentile(0.5)/scale << " " << unit
+      << ", 99% < " << percentile(0.99)/scale << " " << unit << ", max " << max/scale << " " << unit << std::endl;
+  for (int i=0; i < LOG_HISTOGRAM_BUCKETS; i++) {
+    if (buckets[i]==0) continue;
+    uint64_t low=i==0 ? 0 : 1ULL << (i-1);
+    out << "  >= " << low/scale << " " << unit << ": " << buckets[i] << std::endl;
+  };
+};
+
+LogHistogram::LogHistogram() : count(0), total(0), max(0) {
+  for (int i=0; i < LOG_HISTOGRAM_BUCKETS; i++) {
+    buckets[i].store(0, std::memory_order_relaxed);
+  };
+};
+
+void LogHistogram::add(uint64_t value) {
+  //Index of the highest set bit, plus one
+  int bucket=value==0 ? 0 : 64-__builtin_clzll(value);
+  //We are the only writer, so plain loads and stores are enough (and cheaper than atomic increments)
+  buckets[bucket].store(buckets[bucket].load(std::memory_order_relaxed)+1, std::memory_order_relaxed);
+  total.store(total.load(std::memory_order_relaxed)+value, std::memory_order_relaxed);
+  if (value > max.load(std::memory_order_relaxed)) {
+    max.store(value, std::memory_order_relaxed);
+  };
+  count.store(count.load(std::memory_order_relaxed)+1, std::memory_order_release);
+};
+
+histogram_t LogHistogram::snapshot() const {
+  histogram_t snap;
+  snap.count=count.load(std::memory_order_acquire);
+  for (int i=0; i < LOG_HISTOGRAM_BUCKETS; i++) {
+    snap.buckets[i]=buckets[i].load(std::memory_order_relaxed);
+  };
+  snap.total=total.load(std::memory_order_relaxed);
+  snap.max=max.load(std::memory_order_relaxed);
+  return snap;
+};
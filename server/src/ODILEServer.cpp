@@ -1,12 +1,26 @@
 #include "ODILEServer.hpp"
+#include "DataWriter.hpp"
+#include "PacketBatch.hpp"
+#include "PacketSocket.hpp"
+#include "UringQueue.hpp"
+#include "XdpSocket.hpp"
 
 #include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <set>
+#include <atomic>
 #include <pthread.h>
 #include <byteswap.h>
-//To properly format hex to text files
-#include <iomanip>
 #include <iostream>
 #include <sys/time.h>
+#include <ctime>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <arpa/inet.h>
 
 //#if defined __has_include
 // #if __has_include(<cfitsio.h>)
@@ -18,9 +32,6 @@
 
 using namespace udp_client_server;
 
-#define BUFFSIZE 2048
-#define WAIT_TIME 1000
-
 //Start addresses for our 10 configuration pages. Each one starts at a sector edge in the flash memory (so we can erase pages independently).
 uint32_t CONFIG_PAGE_ADDRESS[10] = {0x01F60000,0x01F70000,0x01F80000,0x01F90000,0x01FA0000,
 				    0x01FB0000,0x01FC0000,0x01FD0000,0x01FE0000,0x01FF0000};
@@ -30,13 +41,37 @@ ODILEServer::ODILEServer(std::string odile_address) : odile_address(odile_addres
   //Setup our configuration data blocks
   configBlocks=ConfigBlockList();
   server_address=NULL_IPADDRESS;
+  has_command_policy=false;
+  busy_poll_us=0;
+  filter_source=false;
+  filtered_packets=0;
+  sockets_created=0;
+  mtu=DEFAULT_MTU;
+  command_window=COMMAND_WINDOW;
+  failed_commands=0;
 };
 
 ODILEServer::~ODILEServer() {
   //Cleanup any asyncronous threads we have lying around
+  for (unsigned int i=0; i< session_args.size(); i++) {
+    closeSession(i);
+  };
+  for (unsigned int i=0; i< group_args.size(); i++) {
+    closeGroup(i);
+  };
+  for (unsigned int i=0; i< demux_args.size(); i++) {
+    closeDemux(i);
+  };
   for (unsigned int i=0; i< thread_args.size(); i++) {
     closeAsyncThread(i);
   };
+  closeReceiveSockets();
+  for (std::map<int, udp_client*>::iterator it=send_sockets.begin(); it != send_sockets.end(); ++it) {
+    delete it->second;
+  };
+  for (std::map<int, TokenBucket*>::iterator it=pacers.begin(); it != pacers.end(); ++it) {
+    delete it->second;
+  };
 }
 
 /*
@@ -75,17 +110,22 @@ int ODILEServer::readConfigData(std::string inifile) {
   <	If timeout_ms is < 0, waits indefinitely, otherwise waits for the timeout.
 */
 bool ODILEServer::waitForDone(std::string command, int timeout_ms) {
+  //A reply to a pipelined command would be taken for ours
+  completePendingCommands();
+  //Replies are missed if we get descheduled while they arrive, so run under the command policy until we return
+  ScopedThreadPolicy scoped_policy(has_command_policy ? &command_policy : NULL,
+				  has_command_policy ? PacketSocket::findInterface(server_address) : "");
   int bytes_recvd=-1;
   std::vector<uint32_t> buffer;
   bool timed_out=false;
   timespec ts;
-  clock_gettime(CLOCK_REALTIME, &ts);
-  long starttime=ts.tv_nsec/1000/1000;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  long starttime=ts.tv_sec*1000+ts.tv_nsec/1000/1000;
   //Wait until we time our *or* recieve back 'DON' signal
   while (timed_out==false) {
     //Receive our data
     bytes_recvd=recieveData(&buffer, COMMAND_PORT, timeout_ms/10);
-    clock_gettime(CLOCK_REALTIME,&ts);
+    clock_gettime(CLOCK_MONOTONIC,&ts);
     if (bytes_recvd>0) {
       //scan over our buffer for 'DON'
       for (int i=0; i < buffer.size(); i++) {
@@ -95,7 +135,7 @@ bool ODILEServer::waitForDone(std::string command, int timeout_ms) {
 	};
       };
     } 
-    long currtime=ts.tv_nsec/1000/1000;
+    long currtime=ts.tv_sec*1000+ts.tv_nsec/1000/1000;
     if (timeout_ms > 0 & ((currtime-starttime) > timeout_ms)) {
       timed_out=true;
       return false;
@@ -104,23 +144,371 @@ bool ODILEServer::waitForDone(std::string command, int timeout_ms) {
   return false;
 };
 
+/*
+  Sets the CPU, scheduling and memory policy used while waiting for command replies (see waitForDone). The policy is applied to whichever thread calls waitForDone, and undone when it returns.
+*/
+void ODILEServer::setCommandPolicy(thread_policy_t policy) {
+  command_policy=policy;
+  has_command_policy=true;
+};
+
+//Busy-polls the command reply socket for usecs microseconds per receive call, for lower latency replies in waitForDone() (0 goes back to select()).
+void ODILEServer::setBusyPoll(int usecs) {
+  busy_poll_us=usecs;
+  //The receive sockets pick the setting up when they are bound again
+  closeReceiveSockets();
+};
+
+/*
+  Has the kernel drop datagrams that don't come from the board (see udp_server::attach_filter) on the sockets waitForDone(), recieveData() and measureCommandLatency() receive on, so stray traffic on those ports never wakes us up.
+  The board answers from the port it sends to, so the filter checks the source port as well as the board's address (see boardAddress).
+*/
+void ODILEServer::setSourceFilter(bool enable) {
+  filter_source=enable;
+  closeReceiveSockets();
+};
+
+/*
+  Number of datagrams the source filter has rejected on the command reply and synchronous receive sockets so far.
+  The kernel counts these with the datagrams it drops for lack of buffer space, which at command rates means the count is the filtered ones.
+*/
+int ODILEServer::getFilteredPackets() {
+  int nfiltered=filtered_packets;
+  for (std::map<std::pair<std::string,int>, udp_server*>::iterator it=receive_sockets.begin(); filter_source && it != receive_sockets.end(); ++it) {
+    int ndropped=it->second->get_drop_count();
+    if (ndropped > 0) {
+      nfiltered+=ndropped;
+    };
+  };
+  return nfiltered;
+};
+
+//Attaches the source filter to a command reply or synchronous receive socket, if setSourceFilter() is on
+void ODILEServer::attachSourceFilter(udp_server &server) {
+  if (!filter_source) return;
+  if (server.attach_filter(boardAddress(server.get_port()), server.get_port()) != 0) {
+    std::cout << "Warning: could not filter port 0x" << std::hex << server.get_port() << std::dec << " by source: " << strerror(errno) << std::endl;
+  };
+};
+
+/*
+  Socket the synchronous receives (recieveData, waitForDone, measureCommandLatency) use for port. Bound on first use and then kept, so replies queue up between calls instead of being lost while no socket is bound, and each receive costs no socket setup.
+  A socket bound to the wildcard address (NULL_IPADDRESS with no server address set) also serves requests for a specific address on the same port and vice versa, since the two could not both be bound.
+  While a socket is kept, another ODILEServer (or send_command) can't bind the same port. The port is not shared with SO_REUSEADDR, since the kernel would then give every reply to whichever socket was bound last, and the other side would just time out.
+  Throws udp_client_server_runtime_error if the port can't be bound, saying so when another socket holds it.
+*/
+udp_server* ODILEServer::receiveSocket(std::string serv_address, int port) {
+  if (serv_address==NULL_IPADDRESS) {
+    serv_address=server_address;
+  };
+  std::map<std::pair<std::string,int>, udp_server*>::iterator it=receive_sockets.find(std::make_pair(serv_address, port));
+  if (it != receive_sockets.end()) {
+    return it->second;
+  };
+  for (it=receive_sockets.begin(); it != receive_sockets.end(); ++it) {
+    if (it->first.second==port && (it->first.first==NULL_IPADDRESS || serv_address==NULL_IPADDRESS)) {
+      return it->second;
+    };
+  };
+  udp_server *server;
+  try {
+    server=new udp_server(serv_address, port);
+  } catch (udp_client_server_runtime_error &e) {
+    if (errno==EADDRINUSE) {
+      std::stringstream msg;
+      msg << "port 0x" << std::hex << port << " is already bound by another ODILEServer or process (e.g. send_command), close it to receive here";
+      throw udp_client_server_runtime_error(msg.str().c_str());
+    };
+    throw;
+  };
+  sockets_created++;
+  if (busy_poll_us > 0) {
+    server->enable_busy_poll(busy_poll_us);
+  };
+  attachSourceFilter(*server);
+  receive_sockets[std::make_pair(serv_address, port)]=server;
+  return server;
+};
+
+//Binds the socket for synchronous receives on port now, so that nothing sent to it from now on is lost (see receiveSocket)
+void ODILEServer::openReceiveSocket(int port, std::string serv_address) {
+  receiveSocket(serv_address, port);
+};
+
+//Closes the sockets of the synchronous receives, freeing their ports (e.g. for an async receive thread on the same port)
+void ODILEServer::closeReceiveSockets() {
+  for (std::map<std::pair<std::string,int>, udp_server*>::iterator it=receive_sockets.begin(); it != receive_sockets.end(); ++it) {
+    //Keep count of what the source filter rejected on the socket
+    int ndropped=filter_source ? it->second->get_drop_count() : 0;
+    if (ndropped > 0) {
+      filtered_packets+=ndropped;
+    };
+    delete it->second;
+  };
+  receive_sockets.clear();
+};
+
+//Throws away whatever is queued on a receive socket
+static void drainSocket(udp_server *server) {
+  char buffer[BUFFSIZE];
+  while (server->timed_recv(buffer, BUFFSIZE, 0) >= 0) {
+  };
+};
+
+/*
+  Sends a command count times, waiting up to timeout_ms for its reply each time, and returns the round-trip times. The reply socket is the long-lived one (with busy polling if setBusyPoll() is on), so the times compare the receive paths rather than socket setup.
+*/
+latency_stats_t ODILEServer::measureCommandLatency(std::string cmd_str, int count, int timeout_ms) {
+  latency_stats_t stats;
+  udp_server &server=*receiveSocket(NULL_IPADDRESS, COMMAND_PORT);
+  std::vector<double> rtts;
+  uint32_t buffer[BUFFSIZE/4];
+  for (int i=0; i < count; i++) {
+    timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    sendCommand(cmd_str);
+    bool replied=false;
+    //Skip the echo of the command and wait for the DON/INV/ERR reply
+    int nbytes;
+    while (!replied && (nbytes=server.timed_recv((char *)buffer, BUFFSIZE, timeout_ms)) > 0) {
+      for (int j=0; j < nbytes/4; j++) {
+	uint32_t word=bswap_32(buffer[j]) & 0x00FFFFFF;
+	if (word==stringToInt("DON") || word==stringToInt("INV") || word==stringToInt("ERR")) {
+	  replied=true;
+	};
+      };
+    };
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (replied) {
+      rtts.push_back((end.tv_sec-start.tv_sec)*1.0e6+(end.tv_nsec-start.tv_nsec)/1.0e3);
+    } else {
+      stats.timeouts++;
+    };
+  };
+  stats.count=rtts.size();
+  if (stats.count > 0) {
+    std::sort(rtts.begin(), rtts.end());
+    stats.min_us=rtts.front();
+    stats.max_us=rtts.back();
+    stats.median_us=rtts[rtts.size()/2];
+    for (unsigned int i=0; i < rtts.size(); i++) {
+      stats.mean_us+=rtts[i]/rtts.size();
+    };
+  };
+  return stats;
+};
+
+//Smallest loopback probe: its number, the time it was sent (two words) and one pattern word
+#define LOOPBACK_MIN_PROBE_WORDS 4
+//How long the loopback receive waits for a datagram before checking if it should stop, and how long to wait for the last echoes
+#define LOOPBACK_POLL_MS 10
+#define LOOPBACK_DRAIN_MS 200
+
+//Word i (from 3) of the loopback probe numbered seq
+static uint32_t loopbackPattern(uint32_t seq, int i) {
+  return (seq*0x9E3779B1u) ^ (uint32_t(i)*0x85EBCA6Bu);
+}
+
+static int64_t monotonicNs() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec*1000000000LL+ts.tv_nsec;
+}
+
+//Arguments of the loopback receive thread (see ODILEServer::measureLoopback)
+struct loopback_arg_t {
+  bool stop;
+  udp_server *server;
+  int datagram_bytes;
+  bool app_header;
+  int probe_words;
+  //Echoed words not checked yet, and whether we are looking for the start of a probe after a bad one
+  std::vector<uint32_t> pending;
+  bool resync;
+  loopback_stats_t stats;
+  std::vector<double> rtts;
+  //Polled by measureLoopback() while the thread runs, unlike the stats and rtts, which are read once it has been joined
+  std::atomic<int64_t> last_echo_ns;
+};
+
+/*
+  Checks the probes at the start of the pending echoed words and times the intact ones.
+  The loopback FIFO sends the words back in datagrams of its own size, so probes are found in the word stream rather than in datagrams. After a bad probe, words are skipped until one starts a probe again (its first pattern word matches its number).
+*/
+static void checkLoopbackProbes(loopback_arg_t *arg, int64_t now_ns) {
+  std::vector<uint32_t> &words=arg->pending;
+  size_t pos=0;
+  while (true) {
+    if (arg->resync) {
+      while (pos+LOOPBACK_MIN_PROBE_WORDS <= words.size() && words[pos+3] != loopbackPattern(words[pos], 3)) {
+	pos++;
+	arg->stats.words_skipped++;
+      };
+      if (pos+LOOPBACK_MIN_PROBE_WORDS > words.size()) break;
+      arg->resync=false;
+    };
+    if (pos+arg->probe_words > words.size()) break;
+    uint32_t seq=words[pos];
+    bool intact=true;
+    for (int i=3; i < arg->probe_words && intact; i++) {
+      intact=words[pos+i]==loopbackPattern(seq, i);
+    };
+    if (intact) {
+      int64_t sent_ns=(int64_t(words[pos+1]) << 32) | words[pos+2];
+      arg->rtts.push_back((now_ns-sent_ns)/1.0e3);
+      arg->stats.probes_received++;
+      pos+=arg->probe_words;
+    } else {
+      arg->stats.probes_corrupt++;
+      arg->stats.words_skipped++;
+      pos++;
+      arg->resync=true;
+    };
+  };
+  words.erase(words.begin(), words.begin()+pos);
+}
+
+//Receive thread of measureLoopback(): collects the echoed words and checks them as they arrive
+void * loopbackReceive(void *args) {
+  loopback_arg_t* arg=(loopback_arg_t*) args;
+  std::vector<char> buffer(arg->datagram_bytes);
+  while (!arg->stop) {
+    int nbytes=arg->server->timed_recv(&buffer[0], buffer.size(), LOOPBACK_POLL_MS);
+    if (nbytes <= 0) continue;
+    int64_t now_ns=monotonicNs();
+    char *data=&buffer[0];
+    if (arg->app_header && nbytes >= 4) {
+      data+=4;
+      nbytes-=4;
+    };
+    uint32_t *words=(uint32_t *)data;
+    arg->pending.insert(arg->pending.end(), words, words+nbytes/4);
+    arg->stats.words_received+=nbytes/4;
+    arg->last_echo_ns.store(now_ns, std::memory_order_relaxed);
+    checkLoopbackProbes(arg, now_ns);
+  };
+  return NULL;
+};
+
+/*
+  Probes are paced here rather than with the port's pacer (see setPacing), so that each is timestamped once it is cleared to go and the wait for the bucket is not counted in its round trip.
+  The board echoes the words back as they are, so probes are filled in host byte order and never swapped.
+*/
+loopback_stats_t ODILEServer::measureLoopback(std::string block_name, double seconds, double words_per_second, int probe_words, std::string serv_address) {
+  loopback_stats_t stats;
+  ConfigRegisterBlock &enet_block=configBlocks.getBlock(block_name);
+  int port=enet_block.config_entries[0x0E].value | ENET_LOOPBACK_FIFO;
+  if ((enet_block.getConfigEntry("ENET_FIFO").value & (1 << 2*ENET_LOOPBACK_FIFO))==0) {
+    std::cout << "Warning: the loopback FIFO is not enabled on " << block_name << " (ENET_FIFO bit 8)." << std::endl;
+    return stats;
+  };
+  if (probe_words < 0) {
+    probe_words=enet_block.getConfigEntry("ENET_PacketSize").value;
+  };
+  probe_words=std::max(LOOPBACK_MIN_PROBE_WORDS, std::min(probe_words, maxDatagramWords(port)));
+  loopback_arg_t arg;
+  arg.stop=false;
+  //Bound before the first probe goes out, so no echo arrives while nothing listens
+  udp_server server(serv_address==NULL_IPADDRESS ? boardServerAddress(port) : serv_address, port);
+  arg.server=&server;
+  arg.datagram_bytes=datagramBytes(port);
+  arg.app_header=(enet_block.getConfigEntry("ENET_HeaderConfig").value & HEADER_CONFIG_APP) != 0;
+  arg.probe_words=probe_words;
+  arg.resync=false;
+  arg.last_echo_ns.store(0);
+  pthread_t thread;
+  pthread_create(&thread, NULL, loopbackReceive, &arg);
+  //Take any pacer of the port out of the way while we pace the probes ourselves
+  TokenBucket *saved_pacer=NULL;
+  std::map<int, TokenBucket*>::iterator pacer=pacers.find(port);
+  if (pacer != pacers.end()) {
+    saved_pacer=pacer->second;
+    pacers.erase(pacer);
+  };
+  TokenBucket *bucket=words_per_second > 0 ? new TokenBucket(words_per_second, IN_FIFO_AFULL) : NULL;
+  std::vector<uint32_t> probe(probe_words);
+  int64_t start_ns=monotonicNs();
+  int64_t end_ns=start_ns+int64_t(seconds*1.0e9);
+  for (uint32_t seq=0; monotonicNs() < end_ns; seq++) {
+    probe[0]=seq;
+    for (int i=3; i < probe_words; i++) {
+      probe[i]=loopbackPattern(seq, i);
+    };
+    if (bucket) {
+      bucket->acquire(probe_words);
+    };
+    int64_t now_ns=monotonicNs();
+    probe[1]=uint32_t(now_ns >> 32);
+    probe[2]=uint32_t(now_ns);
+    if (sendData(probe, port) < 0) {
+      std::cout << "Warning: could not send loopback probe " << seq << ": " << strerror(errno) << std::endl;
+      break;
+    };
+    stats.probes_sent++;
+    stats.words_sent+=probe_words;
+  };
+  delete bucket;
+  if (saved_pacer) {
+    pacers[port]=saved_pacer;
+  };
+  //Wait until the echoes stop coming
+  int64_t sent_ns=monotonicNs();
+  while (monotonicNs()-std::max(sent_ns, arg.last_echo_ns.load(std::memory_order_relaxed)) < LOOPBACK_DRAIN_MS*1000000LL) {
+    usleep(1000);
+  };
+  arg.stop=true;
+  pthread_join(thread, NULL);
+  stats.probes_received=arg.stats.probes_received;
+  stats.probes_corrupt=arg.stats.probes_corrupt;
+  stats.words_received=arg.stats.words_received;
+  stats.words_skipped=arg.stats.words_skipped;
+  stats.seconds=(std::max(sent_ns, arg.last_echo_ns.load())-start_ns)/1.0e9;
+  std::vector<double> &rtts=arg.rtts;
+  if (!rtts.empty()) {
+    std::sort(rtts.begin(), rtts.end());
+    stats.min_us=rtts.front();
+    stats.max_us=rtts.back();
+    stats.median_us=rtts[rtts.size()/2];
+    stats.p90_us=rtts[size_t(rtts.size()*0.9)];
+    stats.p99_us=rtts[size_t(rtts.size()*0.99)];
+    stats.p999_us=rtts[size_t(rtts.size()*0.999)];
+  };
+  return stats;
+};
+
+/*
+  Binds the command reply socket before a command goes out, so a fast reply can't arrive while nothing listens, and throws away the replies to earlier commands nobody waited for.
+*/
+void ODILEServer::prepareReplySocket() {
+  //Replies to pipelined commands may be queued on the socket already
+  if (!pending_commands.empty()) return;
+  try {
+    drainSocket(receiveSocket(NULL_IPADDRESS, COMMAND_PORT));
+  } catch (udp_client_server_runtime_error &e) {
+    //The reply will be missed, but the command can still go out
+    std::cout << "Warning: could not bind the command reply port: " << e.what() << std::endl;
+  };
+};
+
 //Old command sending code.
 int ODILEServer::sendCommand(ODILECommand cmd) {
   if (cmd==INV) return -1;
   std::vector<uint32_t> data;
   data.push_back(bswap_32(cmd));
+  completePendingCommands();
+  prepareReplySocket();
   return cmdClient.send(data);
 };
 
 /*
-  Sends a single command word to the ODILE. If prefix is specified, sets the 8-bit prefix for the command. 
+  Builds the datagram of a command, in network byte order (empty if the command is not valid). If prefix is specified, sets the 8-bit prefix for the command.
   If secondWord is not 0xFFFFFFFF, also sends that after the command.
 */
-int ODILEServer::sendCommand(std::string cmd, int prefix, uint32_t secondWord) {
+std::vector<uint32_t> ODILEServer::commandWords(std::string cmd, int prefix, uint32_t secondWord) {
   std::vector<uint32_t> data;
   if (cmd.length() != 3) {
     std::cout << "Error, command has invalid length..." << std::endl;
-    return -1;
+    return data;
   }
   uint32_t word=stringToInt(cmd);
   //Bounds check our prefix to make sure it is within the 8-bit boundaries. Otherwise, ignore it.
@@ -132,9 +520,124 @@ int ODILEServer::sendCommand(std::string cmd, int prefix, uint32_t secondWord) {
   if (secondWord!=0xFFFFFFFF) {
     data.push_back(bswap_32(secondWord));
   }	
+  return data;
+}
+
+//Sends a single command word to the ODILE (see commandWords).
+int ODILEServer::sendCommand(std::string cmd, int prefix, uint32_t secondWord) {
+  std::vector<uint32_t> data=commandWords(cmd, prefix, secondWord);
+  if (data.empty()) return -1;
+  //The caller reads this command's reply from the socket the pipelined commands are replied on
+  completePendingCommands();
+  prepareReplySocket();
   return cmdClient.send(data);
 }
 
+void ODILEServer::setCommandWindow(int window) {
+  command_window=window > 0 ? window : 1;
+}
+
+/*
+  Sends a command without waiting for its reply, once fewer than command_window commands are in flight. Returns false if the command could not be sent.
+*/
+bool ODILEServer::queueCommand(std::string cmd, int prefix, uint32_t secondWord, int timeout_ms) {
+  std::vector<uint32_t> data=commandWords(cmd, prefix, secondWord);
+  if (data.empty()) return false;
+  while (int(pending_commands.size()) >= command_window) {
+    completeOldestCommand(timeout_ms);
+  };
+  prepareReplySocket();
+  if (cmdClient.send(data) < 0) {
+    std::cout << "Warning: could not send command " << cmd << ": " << strerror(errno) << std::endl;
+    return false;
+  };
+  pending_command_t pending;
+  pending.name=cmd;
+  pending.code=stringToInt(cmd);
+  pending.echoed=false;
+  pending_commands.push_back(pending);
+  return true;
+}
+
+int ODILEServer::flushCommands(int timeout_ms) {
+  completePendingCommands(timeout_ms);
+  int nfailed=failed_commands;
+  failed_commands=0;
+  return nfailed;
+}
+
+/*
+  Waits for every pipelined command in flight, leaving the failures counted for flushCommands().
+*/
+void ODILEServer::completePendingCommands(int timeout_ms) {
+  while (!pending_commands.empty()) {
+    completeOldestCommand(timeout_ms);
+  };
+}
+
+/*
+  Matches the words of a datagram on the command reply port to the pipelined commands. Echoes mark the commands they belong to; each DON, ERR or INV completes the oldest command.
+  A DON or INV before the oldest command's echo is left over from a command sent with sendCommand() and is skipped. An ERR fails the oldest command whether or not it was echoed.
+*/
+void ODILEServer::handleCommandReplies(const uint32_t *buffer, int nwords) {
+  for (int i=0; i < nwords && !pending_commands.empty(); i++) {
+    uint32_t word=bswap_32(buffer[i]);
+    //Replies and echoes have 0xF0 in the top byte, the data words of some replies (GCT, ...) don't
+    if ((word >> 24) != 0xF0) continue;
+    uint32_t code=word & 0x00FFFFFF;
+    pending_command_t &oldest=pending_commands.front();
+    if (code==stringToInt("ERR") || ((code==stringToInt("DON") || code==stringToInt("INV")) && oldest.echoed)) {
+      if (code != stringToInt("DON")) {
+	std::cout << "Warning: command " << oldest.name << " failed (" << (code==stringToInt("ERR") ? "ERR" : "INV") << ")." << std::endl;
+	failed_commands++;
+      };
+      pending_commands.pop_front();
+      continue;
+    };
+    for (unsigned int j=0; j < pending_commands.size(); j++) {
+      if (!pending_commands[j].echoed) {
+	if (pending_commands[j].code==code) {
+	  pending_commands[j].echoed=true;
+	};
+	break;
+      };
+    };
+  };
+}
+
+/*
+  Reads command replies until the oldest pipelined command (and any replied to along with it) is replied to, or timeout_ms passes without that (-1 waits forever).
+  On a timeout the replies can no longer be matched to the commands in order (a late reply would complete the wrong one), so every command in flight is failed and the replies already queued are thrown away.
+  Returns false if a command failed.
+*/
+bool ODILEServer::completeOldestCommand(int timeout_ms) {
+  ScopedThreadPolicy scoped_policy(has_command_policy ? &command_policy : NULL,
+				  has_command_policy ? PacketSocket::findInterface(server_address) : "");
+  udp_server &server=*receiveSocket(NULL_IPADDRESS, COMMAND_PORT);
+  size_t npending=pending_commands.size();
+  int nfailed=failed_commands;
+  uint32_t buffer[MAX_DATAGRAM_BYTES/4];
+  timespec start, now;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  int elapsed_ms=0;
+  while (timeout_ms < 0 || elapsed_ms < timeout_ms) {
+    int nbytes=server.timed_recv((char *)buffer, MAX_DATAGRAM_BYTES, timeout_ms < 0 ? WAIT_TIME : timeout_ms-elapsed_ms);
+    if (nbytes > 0) {
+      handleCommandReplies(buffer, nbytes/4);
+      if (pending_commands.size() < npending) {
+	return failed_commands==nfailed;
+      };
+    };
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    elapsed_ms=(now.tv_sec-start.tv_sec)*1000+(now.tv_nsec-start.tv_nsec)/1000000;
+  };
+  std::cout << "Warning: no reply to command " << pending_commands.front().name << " within " << timeout_ms << " ms, failing the " << pending_commands.size() << " commands in flight." << std::endl;
+  failed_commands+=pending_commands.size();
+  pending_commands.clear();
+  drainSocket(&server);
+  return false;
+}
+
 /*
   Converts a string to a 32-bit uint. Used mainly for converting 3 character ASCII commands into hex equivalent.
 */
@@ -179,6 +682,27 @@ bool ODILEServer::setNTrigSamples(uint16_t nsamples) {
   return true;
 };
 
+bool ODILEServer::setPacketSize(std::string block_name, uint16_t nwords) {
+  configBlocks.getBlock(block_name).getConfigEntry("ENET_PacketSize").value=nwords;
+  return true;
+};
+
+bool ODILEServer::setFifoFlags(std::string block_name, uint16_t flags) {
+  configBlocks.getBlock(block_name).getConfigEntry("ENET_FIFO").value=flags;
+  return true;
+};
+
+bool ODILEServer::setHeaderConfig(std::string block_name, uint16_t header_config) {
+  configBlocks.getBlock(block_name).getConfigEntry("ENET_HeaderConfig").value=header_config;
+  return true;
+};
+
+bool ODILEServer::setCounters(std::string block_name, uint8_t fifo_mask, uint8_t speed) {
+  //Bits 4:0 enable the counters, 15:8 set their speed (the top half of the register shared with ENET_FIFO, see ethernet_block.vhd)
+  configBlocks.getBlock(block_name).getConfigEntry("ENET_CounterEnable").value=(uint16_t(speed) << 8) | (fifo_mask & 0x1F);
+  return true;
+};
+
 /*Helper function to convert nrows and ncols into a number of samples we need to recieve based on current configuration settings (skipper mode, raw ADC/CDS mode, etc).*/
 int ODILEServer::getWordsToRead(int nrows, int ncols, int nskips) {
   //Get our configuration register block
@@ -203,16 +727,100 @@ int ODILEServer::getWordsToRead(int nrows, int ncols, int nskips) {
 //Sets our current server address.
 void ODILEServer::setServerAddress(std::string new_address) {
   server_address=new_address;
+  //Rebind the receive sockets to the new address
+  closeReceiveSockets();
 }
 
+/*
+  Socket sendData() uses for port on the board. Created and connect()ed on first use and then kept, so a send is a single send() call, with no name resolution or route lookup (writeFirmware() sends one page at a time).
+*/
+udp_client* ODILEServer::sendSocket(int port) {
+  std::map<int, udp_client*>::iterator it=send_sockets.find(port);
+  if (it != send_sockets.end()) {
+    return it->second;
+  };
+  udp_client *client=new udp_client(odile_address, port);
+  sockets_created++;
+  if (client->connect() != 0) {
+    //Still works, just with a sendto() per send
+    std::cout << "Warning: could not connect the socket for port " << port << ": " << strerror(errno) << std::endl;
+  };
+  send_sockets[port]=client;
+  return client;
+};
+
+int ODILEServer::getSocketsCreated() {
+  return sockets_created;
+};
+
+void ODILEServer::setPacing(int port, double words_per_second, int depth_words) {
+  std::map<int, TokenBucket*>::iterator it=pacers.find(port);
+  if (it != pacers.end()) {
+    delete it->second;
+    pacers.erase(it);
+  };
+  if (words_per_second > 0) {
+    pacers[port]=new TokenBucket(words_per_second, depth_words);
+  };
+};
+
+double ODILEServer::getPacingWait(int port) {
+  std::map<int, TokenBucket*>::iterator it=pacers.find(port);
+  return it != pacers.end() ? it->second->waitedNs()/1.0e9 : 0;
+};
+
+/*
+  Words the board writes as one unit on port, which a datagram must not split.
+  The sequencer memories take address/value pairs, with the first word of each datagram an address (ports 0x1999 and 0x2000-0x203F, see write_multiplexer in ethernet_ccdcontrol_interface.vhd). The other upload ports (CABAC and CROC programs, EPCQ pages) are plain word streams.
+*/
+static int fragmentUnit(int port) {
+  if (port==SEQ_SERIAL_PORT || (port & 0x3FC0)==0x2000) {
+    return 2;
+  };
+  return 1;
+};
+
+void ODILEServer::setMTU(int new_mtu) {
+  mtu=new_mtu;
+};
+
+int ODILEServer::maxDatagramWords(int port) {
+  int unit=fragmentUnit(port);
+  int words=(mtu-IP_UDP_HEADER_BYTES)/4;
+  return std::max(unit, words-words%unit);
+};
+
 //General purpose data transmission function, sends to an arbitrary port.
 int ODILEServer::sendData(std::vector<uint32_t> data, int port) {
-  udp_client_server::udp_client client(odile_address,port);
-  return client.send(data);
+  int datagram_words=maxDatagramWords(port);
+  if (int(data.size()) > datagram_words) {
+    //The board can't reassemble IP fragments, so send whole datagrams it can take
+    std::vector<int> status=sendBulk(data, port, datagram_words);
+    int bytes_sent=0;
+    for (unsigned int i=0; i < status.size(); i++) {
+      if (status[i] < 0) {
+	errno=-status[i];
+	return -1;
+      };
+      bytes_sent+=status[i];
+    };
+    return bytes_sent;
+  };
+  udp_client *client=sendSocket(port);
+  std::map<int, TokenBucket*>::iterator pacer=pacers.find(port);
+  if (pacer != pacers.end()) {
+    pacer->second->acquire(data.size());
+  };
+  int bytes_sent=client->send(data);
+  //A connected socket reports an ICMP port unreachable from an earlier send on the next one, without sending it
+  if (bytes_sent < 0 && errno==ECONNREFUSED) {
+    bytes_sent=client->send(data);
+  };
+  return bytes_sent;
 }
 
-//Sends data from a text file to specified UDP port.
-int ODILEServer::sendData(std::string ifname, int port) {
+//Reads a text file of hex words into a buffer, in network byte order
+static std::vector<uint32_t> readWordFile(std::string ifname) {
 	std::vector<uint32_t> data;
 	std::ifstream ifile;
 	ifile.open(ifname);
@@ -221,7 +829,98 @@ int ODILEServer::sendData(std::string ifname, int port) {
 	while (ifile >> std::hex >> line) {
 		data.push_back(bswap_32(line));
 	};
-	return sendData(data,port);
+	return data;
+};
+
+//Sends data from a text file to specified UDP port.
+int ODILEServer::sendData(std::string ifname, int port) {
+	return sendData(readWordFile(ifname),port);
+};
+
+std::vector<int> ODILEServer::sendBulk(const std::vector<uint32_t> &data, int port, int datagram_words, bool gso) {
+  std::vector<int> status;
+  int unit=fragmentUnit(port);
+  datagram_words-=datagram_words%unit;
+  if (datagram_words <= 0 || data.empty()) {
+    return status;
+  };
+  int ndatagrams=(data.size()+datagram_words-1)/datagram_words;
+  status.resize(ndatagrams);
+  udp_client *client=sendSocket(port);
+  char *buffer=(char*)&data[0];
+  size_t nbytes=data.size()*4;
+  size_t datagram_bytes=datagram_words*4;
+  if (gso && datagram_bytes > GSO_MAX_BYTES) {
+    gso=false;
+  };
+  std::vector<struct mmsghdr> msgs(gso ? 0 : std::min(ndatagrams, BULK_BATCH));
+  std::vector<struct iovec> iovs(msgs.size());
+  std::map<int, TokenBucket*>::iterator it=pacers.find(port);
+  TokenBucket *pacer=it != pacers.end() ? it->second : NULL;
+  int next=0;
+  bool refused=false;
+  while (next < ndatagrams) {
+    int nsent;
+    if (gso) {
+      int nsegments=std::min(std::min(GSO_MAX_SEGMENTS, int(GSO_MAX_BYTES/datagram_bytes)), ndatagrams-next);
+      if (pacer) {
+	//Only as many datagrams at once as the board buffer has room for
+	nsegments=pacer->acquire(datagram_words, nsegments);
+      };
+      size_t len=std::min(nsegments*datagram_bytes, nbytes-next*datagram_bytes);
+      nsent=client->send_segmented(buffer+next*datagram_bytes, len, datagram_bytes) < 0 ? -1 : nsegments;
+      if (nsent < 0 && pacer) {
+	//Nothing went out, so the retry (or the sendmmsg() fallback) pays for these datagrams again
+	pacer->refund(datagram_words, nsegments);
+      };
+      if (nsent < 0 && (errno==EIO || errno==EINVAL || errno==ENOPROTOOPT)) {
+	std::cout << "Warning: UDP segmentation offload not available (" << strerror(errno) << "), falling back to sendmmsg()." << std::endl;
+	gso=false;
+	msgs.resize(std::min(ndatagrams-next, BULK_BATCH));
+	iovs.resize(msgs.size());
+	continue;
+      };
+      for (int i=0; i < nsent; i++) {
+	status[next+i]=std::min(datagram_bytes, nbytes-(next+i)*datagram_bytes);
+      };
+    } else {
+      int nbatch=std::min(ndatagrams-next, int(msgs.size()));
+      if (pacer) {
+	nbatch=pacer->acquire(datagram_words, nbatch);
+      };
+      memset(&msgs[0], 0, nbatch*sizeof(struct mmsghdr));
+      for (int i=0; i < nbatch; i++) {
+	size_t offset=(next+i)*datagram_bytes;
+	iovs[i].iov_base=buffer+offset;
+	iovs[i].iov_len=std::min(datagram_bytes, nbytes-offset);
+	msgs[i].msg_hdr.msg_iov=&iovs[i];
+	msgs[i].msg_hdr.msg_iovlen=1;
+      };
+      nsent=client->send_batch(&msgs[0], nbatch);
+      if (nsent < nbatch && pacer) {
+	pacer->refund(datagram_words, nbatch-std::max(nsent, 0));
+      };
+      for (int i=0; i < nsent; i++) {
+	status[next+i]=msgs[i].msg_len;
+      };
+    };
+    if (nsent > 0) {
+      next+=nsent;
+      refused=false;
+    } else if (errno==ECONNREFUSED && !refused) {
+      //An ICMP port unreachable from an earlier send, reported instead of sending this one (see sendData)
+      refused=true;
+    } else {
+      status[next]=-errno;
+      next++;
+      refused=false;
+    };
+  };
+  return status;
+};
+
+std::vector<int> ODILEServer::sendBulk(std::string infile, int port, int datagram_words, bool gso) {
+  return sendBulk(readWordFile(infile), port, datagram_words, gso);
 };
 
 //Handler to close an async receive thred.
@@ -232,6 +931,7 @@ int ODILEServer::closeAsyncThread(int thread_id) {
   pthread_join(threads[thread_id], &status);
   //Cleanup our threads
   delete thread_args[thread_id];
+  thread_args[thread_id]=NULL;
   //TODO: fix this to return words read
   return 0;//(int)status;
 };
@@ -250,101 +950,579 @@ int ODILEServer::getWordsRead(int thread_id) {
   }
   return -1;
 }
-//Swaps byte ordering (little endian to big endian or vice versa)
-void swapBufferBytes(uint32_t *buffer, int nwords) {
-  for (int i=0; i < nwords; i++) {
-    buffer[i]=bswap_32(buffer[i]);
+
+//Gets the number of datagrams the kernel dropped on an async receive thread's socket.
+int ODILEServer::getPacketsDropped(int thread_id) {
+  if (isValidThread(thread_id)) {
+    return thread_args[thread_id]->ndropped;
+  }
+  return -1;
+}
+
+//Gets the number of datagrams that were too large for an async receive thread's buffers and lost their tail, while it runs or once it has finished.
+int ODILEServer::getPacketsTruncated(int thread_id) {
+  //isValidThread() turns false once the thread has finished, which is when the final count is there
+  if (thread_id >= 0 && thread_id < int(thread_args.size()) && thread_args[thread_id] != NULL) {
+    return thread_args[thread_id]->ntruncated;
+  }
+  return -1;
+}
+
+//Gets the occupancy and stall counters of the ring between an async receive thread and its writer thread.
+ring_stats_t ODILEServer::getRingStats(int thread_id) {
+  if (isValidThread(thread_id)) {
+    return thread_args[thread_id]->ring_stats.read();
+  }
+  return ring_stats_t();
+}
+
+//CPU time (user+system) used by the process so far, in seconds
+static double processCpuSeconds() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_utime.tv_sec+usage.ru_stime.tv_sec+(usage.ru_utime.tv_usec+usage.ru_stime.tv_usec)/1.0e6;
+}
+
+//Gets the gap, duplicate and reorder counts of an async receive thread running with opts.track_sequence.
+seq_stats_t ODILEServer::getSequenceStats(int thread_id) {
+  if (isValidThread(thread_id)) {
+    return thread_args[thread_id]->tracker.getStats();
+  }
+  return seq_stats_t();
+}
+
+//Gets the loss map of an async receive thread running with opts.track_sequence, once it has finished.
+std::vector<loss_range_t> ODILEServer::getLossMap(int thread_id) {
+  //isValidThread() turns false once the thread has finished, so check the handle directly
+  if (thread_id >= 0 && thread_id < int(thread_args.size()) && thread_args[thread_id] != NULL && thread_args[thread_id]->finished) {
+    return thread_args[thread_id]->tracker.getLossMap();
+  }
+  return std::vector<loss_range_t>();
+}
+
+//Gets the counter continuity of an async receive thread running with opts.check_counters, while it runs or once it has finished.
+counter_stats_t ODILEServer::getCounterStats(int thread_id) {
+  if (thread_id >= 0 && thread_id < int(thread_args.size()) && thread_args[thread_id] != NULL) {
+    return thread_args[thread_id]->counter_checker.getStats();
+  }
+  return counter_stats_t();
+}
+
+//Gets the histogram of the gaps between packet arrivals (in nanoseconds) of an async receive thread running with opts.timestamps, to spot bursts from the board.
+histogram_t ODILEServer::getArrivalGaps(int thread_id) {
+  if (thread_id >= 0 && thread_id < int(thread_args.size()) && thread_args[thread_id] != NULL) {
+    return thread_args[thread_id]->arrival_gaps.snapshot();
+  }
+  return histogram_t();
+}
+
+//Gets the histogram of the delays (in nanoseconds) from the kernel receiving a packet to the receive thread handling it, for a thread running with opts.timestamps, to spot stalls on the host.
+histogram_t ODILEServer::getKernelDelays(int thread_id) {
+  if (thread_id >= 0 && thread_id < int(thread_args.size()) && thread_args[thread_id] != NULL) {
+    return thread_args[thread_id]->kernel_delays.snapshot();
+  }
+  return histogram_t();
+}
+
+//Gets the process CPU time used since an async receive thread started (until it finished), to compare the CPU cost of the receive backends.
+double ODILEServer::getCpuSeconds(int thread_id) {
+  //isValidThread() turns false once the thread has finished, which is when the final time is there
+  if (thread_id >= 0 && thread_id < int(thread_args.size()) && thread_args[thread_id] != NULL) {
+    async_arg_t *arg=thread_args[thread_id];
+    return arg->finished ? arg->cpu_seconds : processCpuSeconds()-arg->cpu_start;
+  }
+  return -1;
+}
+
+/*
+  Counts the words of a received packet. With opts.track_sequence set, first strips the application header from the packet and checks its sequence number: data and len are updated to the part to write (len is 0 for duplicate and late frames, which are not written).
+  With opts.check_counters set, the words written are then checked against the test counter.
+  Returns the application header (0 if it was not stripped).
+*/
+static uint32_t acceptPacket(async_arg_t *arg, char **data, int *len) {
+  uint32_t app_header=0;
+  long missing_frames=0;
+  if (arg->opts.track_sequence && *len >= 4) {
+    app_header=ntohl(*(uint32_t *)*data);
+    *data+=4;
+    *len-=4;
+    missing_frames=arg->tracker.getStats().missing_frames;
+    if (!arg->tracker.check(app_header, *len/4, arg->nread)) {
+      *len=0;
+    };
+  };
+  if (arg->opts.check_counters) {
+    arg->counter_checker.check((const uint32_t *)*data, *len/4, arg->tracker.getStats().missing_frames > missing_frames);
   };
+  arg->nread+=*len/4;
+  return app_header;
 }
+
 /*
-  Asynchronous data receive thread. Designed to receive data from our ODILE asynchronously, so as not to block the main function. Writes to an output file specified in the argument structure.
-  "args" should be a pointer to an async_arg_t struct with the parameters for the data acquisition. 
-  If CFITSIO is installed and the args->outfname contains ".fits", it will automatically write to a .fits file. If CFITSIO is not installed, attempting to write a .fits file will silently fail.
-  If outfname ends in ".txt", will write to text output (in hex format).
-  Otherwise, will output a binary file. The first two words of the binary file will contain the NCOLS and NROWS parameters from the input args.
+  acceptPacket for a buffer of datagrams coalesced by UDP_GRO, all segment_size bytes long except the last (a segment_size of 0 means a single datagram).
+  A single datagram is handled by acceptPacket alone, which moves *data past the application header. With opts.track_sequence every coalesced datagram carries its own application header, so the accepted payloads of several are moved together to the start of the buffer.
+  Returns the length of the data to write from *data, and the application header of the first datagram in *app_header.
 */
-void * asyncRecieve(void *args) {
-  async_arg_t* arg=(async_arg_t*) args;
-  int *words_recvd=new int;
-  bool write_fits=false;
-  bool write_text=false;
+static int acceptSegments(async_arg_t *arg, char **data, int len, int segment_size, uint32_t *app_header) {
+  if (segment_size <= 0 || segment_size >= len) {
+    *app_header=acceptPacket(arg, data, &len);
+    return len;
+  };
+  char *buffer=*data;
+  char *out=buffer;
+  *app_header=0;
+  for (int offset=0; offset < len; offset+=segment_size) {
+    char *segment=buffer+offset;
+    int data_len=std::min(segment_size, len-offset);
+    uint32_t header=acceptPacket(arg, &segment, &data_len);
+    if (offset==0) {
+      *app_header=header;
+    };
+    if (segment != out) {
+      memmove(out, segment, data_len);
+    };
+    out+=data_len;
+  };
+  return out-buffer;
+}
 
-  //If we have CFITSIO, setup fits file stuff.
-#ifdef CFITSIO_INSTALLED
-  fitsfile *fFile;
-  int fstatus=0;
-  LONGLONG curr_pix=1;
-  LONGLONG pix_to_read=arg->nrows*arg->ncols;
-#endif //CFITSIO_INSTALLED
+//Current system time in nanoseconds, the clock the kernel timestamps packets with
+static int64_t realtimeNs() {
+  timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return ts.tv_sec*1000000000LL+ts.tv_nsec;
+}
 
-  std::ofstream outfile;
-  char buffer[BUFFSIZE];	
-  if (arg->outfname.find(".fits")!=std::string::npos &&
-      arg->ncols>0 && arg->nrows>0) {
+/*
+  Adds a packet to the arrival histograms of opts.timestamps: the gap since the previous packet, and the delay from the kernel receiving it (kernel_ns) to now_ns.
+  Gaps use the NIC's time (nic_ns) when there is one, which is free of the host's interrupt and softirq scheduling.
+*/
+static void recordArrival(async_arg_t *arg, int64_t kernel_ns, int64_t nic_ns, int64_t now_ns) {
+  if (kernel_ns==0) return;
+  int64_t arrival_ns=nic_ns != 0 ? nic_ns : kernel_ns;
+  if (arg->last_arrival_ns != 0 && arrival_ns >= arg->last_arrival_ns) {
+    arg->arrival_gaps.add(arrival_ns-arg->last_arrival_ns);
+  };
+  arg->last_arrival_ns=arrival_ns;
+  //A clock step can put the timestamp in the future
+  if (now_ns >= kernel_ns) {
+    arg->kernel_delays.add(now_ns-kernel_ns);
+  };
+}
 
-#ifdef CFITSIO_INSTALLED
-    //Create fits file and image
-    //TODO: make this handle errors in file creation
-    fits_create_file(&fFile, arg->outfname.c_str(), &fstatus);
-    long naxis=2;
-    long naxes[2]={arg->ncols, arg->nrows};
-    fits_create_img(fFile, LONG_IMG, naxis, naxes,&fstatus);
-    write_fits=true;
-#endif //CFITSIO_INSTALLED
+//Arguments for the writer thread of an async receive thread
+struct writer_arg_t {
+  PacketRing *ring;
+  DataWriter *writer;
+  thread_policy_t policy;
+  std::string ifname;
+};
 
-  } else if (arg->outfname.find(".txt")!=std::string::npos) {
-    //Run in text output mode
-    outfile.open(arg->outfname, std::ios::out);
-    write_text=true;
-  } else {
-    //Write binary data
-    outfile.open(arg->outfname, std::ios::out | std::ios::binary);
-    //Start by writing the ncols and nrows parameters, if they make sense
-    if (arg->ncols>0 && arg->nrows>0) {
-      uint32_t nrows=bswap_32(arg->nrows);
-      uint32_t ncols=bswap_32(arg->ncols);
-      outfile.write((char *) &ncols, sizeof(uint32_t));
-      outfile.write((char *) &nrows, sizeof(uint32_t));
-    }
+/*
+  Writer thread for asyncRecieve. Drains packets from the ring and writes them to disk, so a slow disk never holds up the socket. Exits once the receive thread closes the ring and every packet has been written.
+*/
+void * asyncWrite(void *args) {
+  writer_arg_t* arg=(writer_arg_t*) args;
+  applyThreadPolicy(arg->policy, arg->ifname);
+  int npackets;
+  while ((npackets=arg->ring->waitFilled()) > 0) {
+    for (int i=0; i < npackets; i++) {
+      packet_slot_t &slot=arg->ring->consumerSlot(i);
+      arg->writer->write(slot.data, slot.len);
+      if (slot.release) {
+	slot.release(slot.release_ctx, slot.data);
+      };
+    };
+    arg->ring->release(npackets);
   };
-  arg->nread=0;
+  return NULL;
+};
+
+/*
+  Receive loop for BACKEND_UDP. Datagrams are drained arg->opts.batch_size at a time with recvmmsg(), straight into the free ring slots (or into a local batch if there is no ring).
+  With arg->opts.gro each slot may hold several coalesced datagrams, which are checked one by one (see acceptSegments) but written as one block.
+  The kernel's count of datagrams dropped on the socket (buffer overflows) is kept in arg->ndropped.
+*/
+void receiveUDP(async_arg_t *arg, PacketRing *ring, DataWriter &writer) {
   udp_server data_server(arg->ip_address, arg->port);
+  if (arg->opts.rcvbuf_bytes > 0) {
+    data_server.set_rcvbuf(arg->opts.rcvbuf_bytes);
+  };
+  arg->rcvbuf_bytes=data_server.get_rcvbuf();
+  data_server.enable_drop_count();
+  if (arg->opts.busy_poll_us > 0) {
+    data_server.enable_busy_poll(arg->opts.busy_poll_us);
+  };
+  if (arg->opts.timestamps && data_server.enable_timestamps(arg->opts.hardware_timestamps) != 0) {
+    std::cout << "Warning: could not enable packet timestamps on port 0x" << std::hex << arg->port << std::dec << ": " << strerror(errno) << std::endl;
+  };
+  if (arg->opts.filter_source && data_server.attach_filter(arg->board_address, arg->port) != 0) {
+    std::cout << "Warning: could not filter port 0x" << std::hex << arg->port << std::dec << " by source: " << strerror(errno) << std::endl;
+  };
+  if (arg->opts.gro && data_server.enable_gro() != 0) {
+    std::cout << "Warning: could not enable UDP GRO on port 0x" << std::hex << arg->port << std::dec << ": " << strerror(errno) << std::endl;
+  };
+  PacketBatch batch(arg->opts.batch_size, arg->opts.gro ? GRO_BUFFSIZE : arg->datagram_bytes);
   while (!arg->stop) {
-    int packet_len=data_server.timed_recv(buffer, BUFFSIZE, WAIT_TIME);
-    if (packet_len > 0) {
-      int nwords=packet_len/4;
-      *words_recvd+=nwords;
-      arg->nread+=nwords;
-
-      if (write_fits) {
-#ifdef CFITSIO_INSTALLED
-	if (curr_pix <= pix_to_read) {
-	  swapBufferBytes((uint32_t*)buffer, nwords);
-	  fits_write_img(fFile, TINT, curr_pix, LONGLONG(nwords), buffer, &fstatus);
-	  curr_pix+=LONGLONG(nwords);
-	}
-#endif //CFITSIO_INSTALLED
+    int npackets;
+    if (ring) {
+      //Receive straight into the free ring slots
+      int nfree=ring->waitFree();
+      int nrecv=nfree < batch.size() ? nfree : batch.size();
+      for (int i=0; i < nrecv; i++) {
+	batch.setBuffer(i, ring->producerBuffer(i));
+      };
+      npackets=batch.recv(data_server, arg->opts.timeout_ms, nrecv);
+    } else {
+      npackets=batch.recv(data_server, arg->opts.timeout_ms);
+    };
+    arg->ndropped=batch.dropCount();
+    int64_t now_ns=arg->opts.timestamps ? realtimeNs() : 0;
+    for (int i=0; i < npackets; i++) {
+      if (arg->opts.timestamps) {
+	recordArrival(arg, batch.timestamp(i), batch.hardwareTimestamp(i), now_ns);
+      };
+      if (batch.truncated(i)) {
+	arg->ntruncated++;
+      };
+      char *data=batch.data(i);
+      uint32_t app_header;
+      int packet_len=acceptSegments(arg, &data, batch.length(i), batch.segmentSize(i), &app_header);
+      if (ring) {
+	ring->producerSlot(i).data=data;
+	ring->producerSlot(i).len=packet_len;
+	ring->producerSlot(i).app_header=app_header;
       } else {
-	if (write_text) {
-	  for (int i=0; i < nwords; i++) {
-	    uint32_t word=((uint32_t*)buffer)[i];
-	    outfile << std::hex <<std::setw(8) << std::setfill('0') << bswap_32(word) << std::endl;
-	  }
-	}else {
-	  outfile.write(buffer, packet_len);
+	writer.write(data, packet_len);
+      };
+    };
+    if (ring) {
+      ring->publish(npackets);
+      arg->ring_stats.publish(ring->getStats());
+    };
+  };
+  //Catch any drops after the last datagram we received
+  int ndropped=data_server.get_drop_count();
+  if (ndropped > arg->ndropped) {
+    arg->ndropped=ndropped;
+  };
+};
+
+/*
+  Receive loop for BACKEND_PACKET. Frames from the board are captured from a TPACKET_V3 ring; their payloads are handed to the writer thread in place, and each block goes back to the kernel once the writer has written its last packet.
+  arg->ndropped counts the frames the kernel dropped because the ring was full.
+*/
+void receivePacket(async_arg_t *arg, PacketRing *ring, DataWriter &writer) {
+  std::string ifname=arg->opts.interface;
+  if (ifname.empty()) {
+    ifname=PacketSocket::findInterface(arg->ip_address);
+  };
+  PacketSocket data_socket(ifname, arg->board_mac, arg->header_config, arg->port,
+			   arg->opts.packet_block_size, arg->opts.packet_block_count);
+  while (!arg->stop) {
+    struct tpacket_block_desc *block=data_socket.waitBlock(arg->opts.timeout_ms);
+    if (block==NULL) continue;
+    int npackets=block->hdr.bh1.num_pkts;
+    //A filled slot is only published once we know whether it is the block's last one
+    bool pending=false;
+    int64_t now_ns=arg->opts.timestamps ? realtimeNs() : 0;
+    struct tpacket3_hdr *pkt=PacketSocket::firstPacket(block);
+    for (int i=0; i < npackets; i++, pkt=PacketSocket::nextPacket(pkt)) {
+      if (arg->opts.timestamps) {
+	recordArrival(arg, pkt->tp_sec*1000000000LL+pkt->tp_nsec, 0, now_ns);
+      };
+      if (pkt->tp_snaplen < pkt->tp_len) {
+	arg->ntruncated++;
+      };
+      int packet_len;
+      char *data=data_socket.payload(pkt, &packet_len);
+      if (data==NULL) continue;
+      uint32_t app_header=acceptPacket(arg, &data, &packet_len);
+      if (ring) {
+	if (pending) {
+	  ring->publish(1);
 	};
+	ring->waitFree();
+	packet_slot_t &slot=ring->producerSlot(0);
+	slot.data=data;
+	slot.len=packet_len;
+	slot.app_header=app_header;
+	slot.release=NULL;
+	pending=true;
+      } else {
+	writer.write(data, packet_len);
       };
     };
+    if (pending) {
+      //The writer hands the block back after its last packet
+      packet_slot_t &slot=ring->producerSlot(0);
+      slot.release=PacketSocket::releaseBlock;
+      slot.release_ctx=block;
+      ring->publish(1);
+    } else {
+      PacketSocket::releaseBlock(block);
+    };
+    if (ring) {
+      arg->ring_stats.publish(ring->getStats());
+    };
+    arg->ndropped=data_socket.getDropCount();
+  };
+  //The writer must be done with the mapped ring before we unmap it
+  if (ring) {
+    ring->waitEmpty();
   };
+  arg->ndropped=data_socket.getDropCount();
+};
 
-  if (write_fits) {
-#ifdef CFITSIO_INSTALLED
-    fits_close_file(fFile, &fstatus);
-#endif
+/*
+  Receive loop for BACKEND_XDP. An XDP program steers the frames for our port into memory shared with the kernel, and their payloads are handed to the writer thread in place. Each frame goes back to the kernel once it has been written.
+  arg->ndropped counts the frames the kernel dropped because we ran out of frames.
+*/
+void receiveXdp(async_arg_t *arg, PacketRing *ring, DataWriter &writer) {
+  std::string ifname=arg->opts.interface;
+  if (ifname.empty()) {
+    ifname=PacketSocket::findInterface(arg->ip_address);
+  };
+  XdpSocket data_socket(ifname, arg->port, arg->opts.xdp_queue, arg->opts.xdp_frames, arg->opts.xdp_native);
+  while (!arg->stop) {
+    int max=ring ? ring->waitFree() : arg->opts.xdp_frames;
+    int nframes=data_socket.waitFrames(arg->opts.timeout_ms, max);
+    for (int i=0; i < nframes; i++) {
+      int packet_len;
+      char *data=data_socket.frameData(i, &packet_len);
+      uint32_t app_header=acceptPacket(arg, &data, &packet_len);
+      if (ring) {
+	//Even empty frames go through the ring, so only the writer hands frames back
+	packet_slot_t &slot=ring->producerSlot(i);
+	slot.data=data;
+	slot.len=packet_len;
+	slot.app_header=app_header;
+	slot.release=XdpSocket::releaseFrame;
+	slot.release_ctx=&data_socket;
+      } else {
+	writer.write(data, packet_len);
+	XdpSocket::releaseFrame(&data_socket, data);
+      };
+    };
+    data_socket.consumed(nframes);
+    if (ring) {
+      ring->publish(nframes);
+      arg->ring_stats.publish(ring->getStats());
+    };
+    arg->ndropped=data_socket.getDropCount();
+  };
+  if (ring) {
+    ring->waitEmpty();
+  };
+  arg->ndropped=data_socket.getDropCount();
+};
 
-  } else {
-    outfile.close();
-  }
+//user_data of the multishot receive and of its cancellation. Writes carry their buffer ID instead.
+#define URING_RECV_TAG 0xFFFFFFFFFFFFFFFFULL
+#define URING_CANCEL_TAG 0xFFFFFFFFFFFFFFFEULL
+//Submission queue entries of the io_uring backend
+#define URING_ENTRIES 256
+
+/*
+  Receive loop for BACKEND_URING. A multishot receive fills buffers picked by the kernel from a provided buffer ring. For binary output, each buffer is then written to the file by a write request queued on the same ring, and given back to the kernel once written, so a packet costs no system calls or copies of its own.
+  Other output formats are written from this thread. Throws uring_runtime_error if the kernel can't do this (before anything has been received).
+*/
+void receiveUring(async_arg_t *arg, DataWriter &writer) {
+  int nbufs=64;
+  while (nbufs < arg->opts.ring_slots) {
+    nbufs*=2;
+  };
+  //One spare word, so that a datagram filling a whole buffer must have been cut short (the receive doesn't report MSG_TRUNC)
+  int buffer_size=arg->datagram_bytes+4;
+  UringQueue uring(URING_ENTRIES, nbufs, buffer_size);
+  udp_server data_server(arg->ip_address, arg->port);
+  if (arg->opts.rcvbuf_bytes > 0) {
+    data_server.set_rcvbuf(arg->opts.rcvbuf_bytes);
+  };
+  if (arg->opts.filter_source && data_server.attach_filter(arg->board_address, arg->port) != 0) {
+    std::cout << "Warning: could not filter port 0x" << std::hex << arg->port << std::dec << " by source: " << strerror(errno) << std::endl;
+  };
+  arg->rcvbuf_bytes=data_server.get_rcvbuf();
+  //Binary data goes straight from the receive buffers to the file, after whatever the writer already wrote (the header)
+  int file_fd=-1;
+  long file_offset=0;
+  if (writer.isBinary()) {
+    file_offset=writer.tell();
+    file_fd=open(arg->outfname.c_str(), O_WRONLY | O_CLOEXEC);
+  };
+  uring.prepRecvMultishot(data_server.get_socket(), URING_RECV_TAG);
+  bool armed=true;
+  bool cancelling=false;
+  bool write_error=false;
+  int inflight=0;
+  int npackets=0;
+  //The kernel may fill our buffers for as long as the receive is armed, so it must be cancelled and its last completion reaped before they are freed
+  while (!arg->stop || inflight > 0 || armed || cancelling) {
+    //The receive stops when the kernel runs out of buffers, restart it once some are back
+    if (!armed && !arg->stop && inflight < nbufs) {
+      uring.prepRecvMultishot(data_server.get_socket(), URING_RECV_TAG);
+      armed=true;
+    };
+    if (armed && arg->stop && !cancelling) {
+      uring.prepCancel(URING_RECV_TAG, URING_CANCEL_TAG);
+      cancelling=true;
+    };
+    if (!uring.submitAndWait(1, arg->opts.timeout_ms)) {
+      arg->ndropped=data_server.get_drop_count();
+      continue;
+    };
+    struct io_uring_cqe *cqe;
+    while ((cqe=uring.peekCqe()) != NULL) {
+      if (cqe->user_data==URING_CANCEL_TAG) {
+	//The receive may have ended on its own before the cancellation got to it, which is fine
+	cancelling=false;
+      } else if (cqe->user_data==URING_RECV_TAG) {
+	if ((cqe->flags & IORING_CQE_F_MORE)==0) {
+	  armed=false;
+	};
+	if (cqe->res < 0 && cqe->res != -ENOBUFS && cqe->res != -ECANCELED) {
+	  std::string error=strerror(-cqe->res);
+	  uring.cqeSeen();
+	  if (file_fd >= 0) close(file_fd);
+	  throw uring_runtime_error("multishot receive failed: "+error);
+	} else if (cqe->res > 0 && (cqe->flags & IORING_CQE_F_BUFFER)) {
+	  int bid=cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+	  char *data=uring.bufferData(bid);
+	  int packet_len=cqe->res;
+	  if (packet_len >= buffer_size) {
+	    arg->ntruncated++;
+	  };
+	  acceptPacket(arg, &data, &packet_len);
+	  if (file_fd >= 0 && packet_len > 0) {
+	    uring.prepWrite(file_fd, data, packet_len, file_offset, bid);
+	    file_offset+=packet_len;
+	    inflight++;
+	  } else {
+	    writer.write(data, packet_len);
+	    uring.recycleBuffer(bid);
+	  };
+	  //Checking the drop counter is a system call, so only do it now and then
+	  if (++npackets % 1024==0) {
+	    arg->ndropped=data_server.get_drop_count();
+	  };
+	};
+      } else {
+	//A write finished, its buffer can take packets again
+	if (cqe->res < 0 && !write_error) {
+	  std::cout << "Error writing to " << arg->outfname << ": " << strerror(-cqe->res) << std::endl;
+	  write_error=true;
+	};
+	uring.recycleBuffer(cqe->user_data);
+	inflight--;
+      };
+      uring.cqeSeen();
+    };
+  };
+  if (file_fd >= 0) close(file_fd);
+  arg->ndropped=data_server.get_drop_count();
+};
+
+/*
+  Asynchronous data receive thread. Designed to receive data from our ODILE asynchronously, so as not to block the main function. Writes to an output file specified in the argument structure (see DataWriter for the output formats).
+  "args" should be a pointer to an async_arg_t struct with the parameters for the data acquisition. args->opts.backend selects how packets are received (see receiveUDP and receivePacket).
+  If args->opts.ring_slots is non-zero, packets are passed through a PacketRing to a separate writer thread (asyncWrite), otherwise they are written from this thread. The threads of an acquisition session pass them to the session's merger through args->output_ring instead.
+*/
+void * asyncRecieve(void *args) {
+  async_arg_t* arg=(async_arg_t*) args;
+  int *words_recvd=new int(0);
+  //Pin and prioritize the thread before it allocates its buffers, so they land on the right NUMA node
+  std::string ifname=arg->opts.interface.empty() ? PacketSocket::findInterface(arg->ip_address) : arg->opts.interface;
+  applyThreadPolicy(arg->opts.receive_policy, ifname);
+  DataWriter writer;
+  if (!arg->output_ring) {
+    writer.open(arg->outfname, arg->nrows, arg->ncols);
+  };
+  arg->nread=0;
+  arg->ndropped=0;
+  arg->ntruncated=0;
+  arg->cpu_start=processCpuSeconds();
+  if (arg->opts.backend==BACKEND_XDP && arg->datagram_bytes+42 > XDP_MAX_FRAME_BYTES) {
+    //Ethernet, IP and UDP headers included, a jumbo frame doesn't fit in a UMEM frame
+    std::cout << "Packets of " << arg->datagram_bytes << " bytes don't fit in an AF_XDP frame, using UDP sockets." << std::endl;
+    arg->opts.backend=BACKEND_UDP;
+  };
+  if (arg->opts.timestamps && (arg->opts.backend==BACKEND_URING || arg->opts.backend==BACKEND_XDP)) {
+    std::cout << "Warning: packet timestamps are only available with the UDP and packet backends." << std::endl;
+  };
+  if (arg->opts.backend==BACKEND_URING) {
+    try {
+      receiveUring(arg, writer);
+    } catch (uring_runtime_error &e) {
+      //Nothing has been written yet if the kernel turned us down, so we can start over with plain sockets
+      if (arg->nread > 0) {
+	std::cout << "Error in io_uring receive thread on port 0x" << std::hex << arg->port << std::dec << ": " << e.what() << std::endl;
+	arg->stop=true;
+      } else {
+	std::cout << "io_uring unavailable (" << e.what() << "), falling back to UDP sockets." << std::endl;
+	arg->opts.backend=BACKEND_UDP;
+      };
+    } catch (std::runtime_error &e) {
+      std::cout << "Error starting receive thread on port 0x" << std::hex << arg->port << std::dec << ": " << e.what() << std::endl;
+      arg->stop=true;
+    };
+  };
+  PacketRing *ring=arg->output_ring;
+  pthread_t writer_thread;
+  writer_arg_t writer_arg;
+  if (!ring && arg->opts.ring_slots > 0 && !arg->stop && arg->opts.backend != BACKEND_URING) {
+    //Zero-copy backends point the slots at their own memory
+    int slot_size=arg->opts.backend==BACKEND_UDP ? (arg->opts.gro ? GRO_BUFFSIZE : arg->datagram_bytes) : 0;
+    ring=new PacketRing(arg->opts.ring_slots, slot_size);
+    writer_arg.ring=ring;
+    writer_arg.writer=&writer;
+    writer_arg.policy=arg->opts.writer_policy;
+    writer_arg.ifname=ifname;
+    pthread_create(&writer_thread, NULL, asyncWrite, &writer_arg);
+  };
+  try {
+    if (arg->opts.backend==BACKEND_PACKET) {
+      receivePacket(arg, ring, writer);
+    } else if (arg->opts.backend==BACKEND_XDP) {
+      receiveXdp(arg, ring, writer);
+    } else if (arg->opts.backend==BACKEND_UDP) {
+      receiveUDP(arg, ring, writer);
+    };
+  } catch (std::runtime_error &e) {
+    std::cout << "Error starting receive thread on port 0x" << std::hex << arg->port << std::dec << ": " << e.what() << std::endl;
+  };
+  if (arg->output_ring) {
+    //The merger drains what is left, and owns the ring
+    ring->close();
+    arg->ring_stats.publish(ring->getStats());
+  } else if (ring) {
+    //Let the writer finish what is left in the ring
+    ring->close();
+    pthread_join(writer_thread, NULL);
+    arg->ring_stats.publish(ring->getStats());
+    delete ring;
+  };
+  if (arg->ndropped > 0) {
+    //The kernel counts the datagrams the source filter rejects as drops
+    std::cout << "Warning: kernel dropped " << arg->ndropped << (arg->opts.filter_source ? " packets (including stray ones filtered out)" : " packets") << " on port 0x" << std::hex << arg->port << std::dec;
+    if (arg->opts.backend==BACKEND_UDP || arg->opts.backend==BACKEND_URING) {
+      std::cout << " (receive buffer " << arg->rcvbuf_bytes << " bytes)";
+    };
+    std::cout << std::endl;
+  };
+  if (arg->ntruncated > 0) {
+    std::cout << "Warning: " << arg->ntruncated << " packets on port 0x" << std::hex << arg->port << std::dec << " were larger than the " << arg->datagram_bytes << " byte receive buffers and got cut short (check ENET_PacketSize)." << std::endl;
+  };
+  if (arg->opts.track_sequence) {
+    std::cout << "Sequence check on port 0x" << std::hex << arg->port << std::dec << ":" << std::endl;
+    arg->tracker.report(std::cout);
+  };
+  if (arg->opts.check_counters) {
+    std::cout << "Counter check on port 0x" << std::hex << arg->port << std::dec << ": ";
+    arg->counter_checker.report(std::cout);
+  };
+  writer.close();
+  arg->cpu_seconds=processCpuSeconds()-arg->cpu_start;
+  *words_recvd=arg->nread;
   arg->finished=true;
   pthread_exit(words_recvd);
 };
@@ -357,17 +1535,22 @@ int ODILEServer::recieveData(std::vector<uint32_t> *data, std::string serv_addre
   if (data==NULL) {
     return -1;
   } else {
-    if (serv_address==NULL_IPADDRESS) {
-      serv_address=server_address;
+    if (port==COMMAND_PORT) {
+      //Replies to pipelined commands must not end up in data
+      completePendingCommands();
     };
-    udp_server server(serv_address, port);
-    uint32_t buffer[BUFFSIZE/4];
+    udp_server &server=*receiveSocket(serv_address, port);
+    uint32_t buffer[MAX_DATAGRAM_BYTES/4];
+    int ntruncated=server.get_truncated_count();
     int nwords=-1;
     if (timeout_ms > 0) {
-      nwords=server.timed_recv((char *)buffer, BUFFSIZE, timeout_ms)/4; 
+      nwords=server.timed_recv((char *)buffer, MAX_DATAGRAM_BYTES, timeout_ms)/4; 
     }  else {
-      nwords=server.recv((char *)buffer, BUFFSIZE)/4;
+      nwords=server.recv((char *)buffer, MAX_DATAGRAM_BYTES)/4;
     }
+    if (server.get_truncated_count() > ntruncated) {
+      std::cout << "Warning: a datagram on port 0x" << std::hex << port << std::dec << " was larger than " << MAX_DATAGRAM_BYTES << " bytes and got cut short." << std::endl;
+    };
     if (swap_bytes) {
       swapBufferBytes(buffer, nwords);
     };
@@ -381,8 +1564,14 @@ int ODILEServer::recieveData(std::vector<uint32_t> *data, std::string serv_addre
 
 /*
   Starts an asynchronous read of UDP data coming in on port, and writes the data to outfile. Returns a thread handler ID that can be used to stop the read.
+  opts sets the receive backend, batch size, timeout, kernel receive buffer size and writer ring size for this thread (see async_opts_t). The raw Ethernet backend picks the board's MAC address and header configuration from the currently loaded configuration.
 */
-int ODILEServer::launchAsyncThread(std::string outfile, std::string serv_address, int port, int nrows, int ncols) {
+int ODILEServer::launchAsyncThread(std::string outfile, std::string serv_address, int port, int nrows, int ncols, async_opts_t opts) {
+  return startAsyncThread(outfile, serv_address, port, nrows, ncols, opts, NULL);
+};
+
+//Starts an async receive thread, writing either to outfile or (for sessions) to output_ring
+int ODILEServer::startAsyncThread(std::string outfile, std::string serv_address, int port, int nrows, int ncols, async_opts_t opts, PacketRing *output_ring) {
   async_arg_t* args=new async_arg_t;
   args->stop=false;
   args->finished=false;
@@ -392,6 +1581,32 @@ int ODILEServer::launchAsyncThread(std::string outfile, std::string serv_address
   args->ip_address=serv_address;
   args->nrows=nrows;
   args->ncols=ncols;
+  args->nread=0;
+  args->ndropped=0;
+  args->datagram_bytes=datagramBytes(port);
+  args->ntruncated=0;
+  args->rcvbuf_bytes=0;
+  args->cpu_start=0;
+  args->cpu_seconds=0;
+  args->opts=opts;
+  args->output_ring=output_ring;
+  args->last_arrival_ns=0;
+  args->board_address=boardAddress(port);
+  //Which board interface sends to this port, for the raw Ethernet backends
+  ConfigRegisterBlock* enet_block=configBlocks.getEnetBlock(port);
+  memset(args->board_mac, 0, sizeof(args->board_mac));
+  args->header_config=HEADER_CONFIG_ETH | HEADER_CONFIG_IP | HEADER_CONFIG_UDP;
+  if (enet_block) {
+    uint16_t mac_words[3]={enet_block->config_entries[2].value, enet_block->config_entries[1].value, enet_block->config_entries[0].value};
+    for (int i=0; i < 3; i++) {
+      args->board_mac[2*i]=mac_words[i] >> 8;
+      args->board_mac[2*i+1]=mac_words[i] & 0xFF;
+    };
+    args->header_config=enet_block->getConfigEntry("ENET_HeaderConfig").value;
+    if (opts.track_sequence && (args->header_config & HEADER_CONFIG_APP)==0) {
+      std::cout << "Warning: sequence tracking needs the application header, but bit 3 of ENET_HeaderConfig is not set." << std::endl;
+    };
+  };
   thread_args.push_back(args);
   pthread_t thread;
   pthread_create(&thread,NULL,asyncRecieve, args);
@@ -399,12 +1614,432 @@ int ODILEServer::launchAsyncThread(std::string outfile, std::string serv_address
   return args->thread_id;
 };
 
+/*
+  Merger thread of an acquisition session. Writes the packets of the session's receive threads to the output file in sequence order (see StreamMerger), until every receive thread has stopped.
+*/
+void * asyncMerge(void *args) {
+  session_arg_t* session=(session_arg_t*) args;
+  applyThreadPolicy(session->policy, session->ifname);
+  DataWriter writer;
+  writer.open(session->outfname, session->nrows, session->ncols);
+  session->merger->run(writer);
+  writer.close();
+  merge_stats_t stats=session->merger->getStats();
+  if (stats.lost > 0 || stats.late > 0) {
+    std::cout << "Warning: merged output is missing " << stats.lost << " frames (" << stats.late << " arrived too late)." << std::endl;
+  };
+  session->finished=true;
+  return NULL;
+};
+
+//Dotted IP address held in two 16-bit configuration entries of an Ethernet block
+static std::string blockIpAddress(ConfigRegisterBlock *enet_block, int hi_entry, int lo_entry) {
+  uint16_t ip_hi=enet_block->config_entries[hi_entry].value;
+  uint16_t ip_lo=enet_block->config_entries[lo_entry].value;
+  return std::to_string(ip_hi >> 8)+"."+std::to_string(ip_hi & 0xFF)+"."+std::to_string(ip_lo >> 8)+"."+std::to_string(ip_lo & 0xFF);
+};
+
+//PC address the board interface sending to port sends its data to (ENET_ServerIP0/1), or NULL_IPADDRESS if no interface sends to port
+std::string ODILEServer::boardServerAddress(int port) {
+  ConfigRegisterBlock* enet_block=configBlocks.getEnetBlock(port);
+  return enet_block ? blockIpAddress(enet_block, 0x0B, 0x0A) : NULL_IPADDRESS;
+};
+
+//Address of the board interface sending to port (ENET_IP1/*_IP0), or the address we send commands to for the ports no data interface sends to (e.g. COMMAND_PORT)
+std::string ODILEServer::boardAddress(int port) {
+  ConfigRegisterBlock* enet_block=configBlocks.getEnetBlock(port);
+  return enet_block ? blockIpAddress(enet_block, 0x09, 0x08) : odile_address;
+};
+
+/*
+  Largest datagram the board interface sending to port sends, in bytes: ENET_PacketSize words, plus the application header word if ENET_HeaderConfig enables it (header_generator.vhd). Never less than BUFFSIZE (also the size for the ports no data interface sends to), nor more than MAX_DATAGRAM_BYTES.
+*/
+int ODILEServer::datagramBytes(int port) {
+  ConfigRegisterBlock* enet_block=configBlocks.getEnetBlock(port);
+  if (!enet_block) {
+    return BUFFSIZE;
+  };
+  int packet_words=enet_block->getConfigEntry("ENET_PacketSize").value;
+  int words=packet_words+((enet_block->getConfigEntry("ENET_HeaderConfig").value & HEADER_CONFIG_APP) ? 1 : 0);
+  if (4*words > MAX_DATAGRAM_BYTES) {
+    std::cout << "Warning: ENET_PacketSize of " << packet_words << " words is more than a jumbo frame holds, packets will be cut short." << std::endl;
+    return MAX_DATAGRAM_BYTES;
+  };
+  return std::max(4*words, BUFFSIZE);
+};
+
+/*
+  Starts an acquisition session: one async receive thread per port (see launchAsyncThread), whose packets are merged into outfile in the order given by their sequence numbers (see StreamMerger). Returns a session ID.
+  The ports can belong to different interfaces (see ConfigBlockList::getDataPorts), so that several links share the bandwidth of one readout. Sequence tracking is always on, so ENET_HeaderConfig must enable the application header on every interface.
+  If serv_address is NULL_IPADDRESS, each thread listens on the PC address its interface sends to (ENET_ServerIP0/1), which also picks the capture interface of the raw backends. The XDP backend can only take one port per interface.
+*/
+int ODILEServer::launchSession(std::string outfile, std::string serv_address, std::vector<int> ports, int nrows, int ncols, async_opts_t opts) {
+  opts.track_sequence=true;
+  if (opts.backend==BACKEND_URING) {
+    //io_uring writes each packet straight to the file, which leaves nothing to merge
+    std::cout << "io_uring can't be used in a merged session, using UDP sockets." << std::endl;
+    opts.backend=BACKEND_UDP;
+  };
+  if (opts.gro) {
+    //A coalesced buffer holds several frames, which the merger has to place one by one
+    std::cout << "UDP GRO can't be used in a merged session, receiving datagrams one by one." << std::endl;
+    opts.gro=false;
+  };
+  if (opts.backend==BACKEND_XDP) {
+    //Only one XDP program fits on an interface
+    std::set<std::string> ifnames;
+    for (unsigned int i=0; i < ports.size(); i++) {
+      std::string address=serv_address==NULL_IPADDRESS ? boardServerAddress(ports[i]) : serv_address;
+      std::string ifname=opts.interface.empty() ? PacketSocket::findInterface(address) : opts.interface;
+      if (!ifnames.insert(ifname).second) {
+	std::cout << "AF_XDP can only take one port per interface, using UDP sockets." << std::endl;
+	opts.backend=BACKEND_UDP;
+	break;
+      };
+    };
+  };
+  if (opts.ring_slots <= 0) {
+    opts.ring_slots=async_opts_t().ring_slots;
+  };
+  session_arg_t* session=new session_arg_t;
+  session->merger=new StreamMerger(opts.timeout_ms);
+  session->outfname=outfile;
+  session->nrows=nrows;
+  session->ncols=ncols;
+  session->finished=false;
+  session->policy=opts.writer_policy;
+  //The merger's rings take the largest packets of any of the ports
+  int slot_size=0;
+  for (unsigned int i=0; opts.backend==BACKEND_UDP && i < ports.size(); i++) {
+    slot_size=std::max(slot_size, datagramBytes(ports[i]));
+  };
+  for (unsigned int i=0; i < ports.size(); i++) {
+    std::string address=serv_address==NULL_IPADDRESS ? boardServerAddress(ports[i]) : serv_address;
+    if (i==0) {
+      session->ifname=opts.interface.empty() ? PacketSocket::findInterface(address) : opts.interface;
+    };
+    PacketRing *ring=session->merger->addInput(opts.ring_slots, slot_size);
+    session->thread_ids.push_back(startAsyncThread(outfile, address, ports[i], nrows, ncols, opts, ring));
+  };
+  session_args.push_back(session);
+  pthread_t thread;
+  pthread_create(&thread, NULL, asyncMerge, session);
+  session_threads.push_back(thread);
+  return session_args.size()-1;
+};
+
+/*
+  Stops the receive threads of a session and waits for the merger to write out what they received. Returns the number of words written.
+*/
+int ODILEServer::closeSession(int session_id) {
+  if (session_id < 0 || session_id >= int(session_args.size()) || session_args[session_id]==NULL) return -1;
+  session_arg_t* session=session_args[session_id];
+  for (unsigned int i=0; i < session->thread_ids.size(); i++) {
+    int thread_id=session->thread_ids[i];
+    if (thread_args[thread_id]==NULL) continue;
+    thread_args[thread_id]->stop=true;
+    pthread_join(threads[thread_id], NULL);
+    delete thread_args[thread_id];
+    thread_args[thread_id]=NULL;
+  };
+  //The merger finishes once the rings of the stopped threads are drained
+  pthread_join(session_threads[session_id], NULL);
+  int nwords=session->merger->getStats().words;
+  delete session->merger;
+  delete session;
+  session_args[session_id]=NULL;
+  return nwords;
+};
+
+//Checks if a session ID is valid (session exists and its merger is still running)
+bool ODILEServer::isValidSession(int session_id) {
+  return !(session_id < 0 || session_id >= int(session_args.size()) ||
+	   session_args[session_id]==NULL ||
+	   session_args[session_id]->finished);
+};
+
+//Gets the IDs of the receive threads of a session, one per port (for getWordsRead(), getPacketsDropped() etc.)
+std::vector<int> ODILEServer::getSessionThreads(int session_id) {
+  if (session_id >= 0 && session_id < int(session_args.size()) && session_args[session_id] != NULL) {
+    return session_args[session_id]->thread_ids;
+  };
+  return std::vector<int>();
+};
+
+//Gets the number of frames and words a session has merged into its output so far, and the number of frames it had to skip.
+merge_stats_t ODILEServer::getMergeStats(int session_id) {
+  if (session_id >= 0 && session_id < int(session_args.size()) && session_args[session_id] != NULL) {
+    return session_args[session_id]->merger->getStats();
+  };
+  return merge_stats_t();
+};
+
+//File name of one shard of a receive group: outfile with the FIFO number added before the extension (e.g. image_fifo2.fits)
+static std::string shardFileName(std::string outfile, int fifo) {
+  size_t dot=outfile.rfind('.');
+  size_t slash=outfile.rfind('/');
+  if (dot==std::string::npos || (slash != std::string::npos && dot < slash)) {
+    dot=outfile.size();
+  };
+  return outfile.substr(0, dot)+"_fifo"+std::to_string(fifo)+outfile.substr(dot);
+};
+
+/*
+  Starts a receive group on the Ethernet block block_name (e.g. "SFP0ConfigBlock"): one async receive thread (shard) per data FIFO the block has enabled in ENET_FIFO, each listening on its own port and writing its own file (see shardFileName). Returns a group ID, or -1 if no FIFO is enabled.
+  Each shard runs on its own core: shard i is pinned to the i-th CPU of opts.receive_policy.cpus (wrapping around when there are more shards than CPUs).
+  The board sends every FIFO as a single flow on its own port, so SO_REUSEPORT could not spread a stream over several sockets (the kernel hashes a flow to one socket of a group); each shard has its own socket instead. If serv_address is NULL_IPADDRESS, the shards listen on the PC address the block sends to.
+*/
+int ODILEServer::launchGroup(std::string outfile, std::string serv_address, std::string block_name, int nrows, int ncols, async_opts_t opts) {
+  std::vector<int> ports=configBlocks.getDataPorts(std::vector<std::string>(1, block_name));
+  if (ports.empty()) {
+    std::cout << "Warning: no data FIFO is enabled on " << block_name << "." << std::endl;
+    return -1;
+  };
+  if (opts.backend==BACKEND_XDP && ports.size() > 1) {
+    //Only one XDP program fits on an interface
+    std::cout << "AF_XDP can only take one port per interface, using UDP sockets." << std::endl;
+    opts.backend=BACKEND_UDP;
+  };
+  std::vector<int> cpus=opts.receive_policy.cpus;
+  group_arg_t* group=new group_arg_t;
+  for (unsigned int i=0; i < ports.size(); i++) {
+    std::string address=serv_address==NULL_IPADDRESS ? boardServerAddress(ports[i]) : serv_address;
+    if (!cpus.empty()) {
+      opts.receive_policy.cpus=std::vector<int>(1, cpus[i % cpus.size()]);
+    };
+    std::string fname=shardFileName(outfile, ports[i] & 0xF);
+    group->ports.push_back(ports[i]);
+    group->outfnames.push_back(fname);
+    group->thread_ids.push_back(startAsyncThread(fname, address, ports[i], nrows, ncols, opts, NULL));
+  };
+  group_args.push_back(group);
+  return group_args.size()-1;
+};
+
+//Stops the shards of a receive group and returns the number of words they received in total.
+int ODILEServer::closeGroup(int group_id) {
+  if (group_id < 0 || group_id >= int(group_args.size()) || group_args[group_id]==NULL) return -1;
+  group_arg_t* group=group_args[group_id];
+  int nwords=0;
+  for (unsigned int i=0; i < group->thread_ids.size(); i++) {
+    int thread_id=group->thread_ids[i];
+    if (thread_args[thread_id]==NULL) continue;
+    //Shards that stopped on an error have finished, but still have to be joined
+    thread_args[thread_id]->stop=true;
+    pthread_join(threads[thread_id], NULL);
+    nwords+=thread_args[thread_id]->nread;
+    delete thread_args[thread_id];
+    thread_args[thread_id]=NULL;
+  };
+  delete group;
+  group_args[group_id]=NULL;
+  return nwords;
+};
+
+//Checks if a group ID is valid (the group exists and at least one of its shards is still running)
+bool ODILEServer::isValidGroup(int group_id) {
+  return getGroupStats(group_id).nrunning > 0;
+};
+
+//Gets the IDs of the receive threads of a group, one per FIFO (for getLossMap(), getArrivalGaps() etc.)
+std::vector<int> ODILEServer::getGroupThreads(int group_id) {
+  if (group_id >= 0 && group_id < int(group_args.size()) && group_args[group_id] != NULL) {
+    return group_args[group_id]->thread_ids;
+  };
+  return std::vector<int>();
+};
+
+//Gets the output files of a group, in the order of getGroupThreads()
+std::vector<std::string> ODILEServer::getGroupFiles(int group_id) {
+  if (group_id >= 0 && group_id < int(group_args.size()) && group_args[group_id] != NULL) {
+    return group_args[group_id]->outfnames;
+  };
+  return std::vector<std::string>();
+};
+
+//Gets the words received, packets dropped and sequence counters of a group, summed over its shards. Works until the group is closed, also once its shards have finished.
+group_stats_t ODILEServer::getGroupStats(int group_id) {
+  group_stats_t stats;
+  if (group_id < 0 || group_id >= int(group_args.size()) || group_args[group_id]==NULL) return stats;
+  group_arg_t* group=group_args[group_id];
+  for (unsigned int i=0; i < group->thread_ids.size(); i++) {
+    async_arg_t *arg=thread_args[group->thread_ids[i]];
+    if (arg==NULL) continue;
+    stats.nshards++;
+    if (!arg->finished) {
+      stats.nrunning++;
+    };
+    stats.words+=arg->nread;
+    stats.dropped+=arg->ndropped;
+    seq_stats_t seq=arg->tracker.getStats();
+    stats.sequence.frames+=seq.frames;
+    stats.sequence.gaps+=seq.gaps;
+    stats.sequence.missing_frames+=seq.missing_frames;
+    stats.sequence.duplicates+=seq.duplicates;
+    stats.sequence.reorders+=seq.reorders;
+    //The shards share the process, so they all report the same CPU time
+    double cpu_seconds=arg->finished ? arg->cpu_seconds : processCpuSeconds()-arg->cpu_start;
+    if (cpu_seconds > stats.cpu_seconds) {
+      stats.cpu_seconds=cpu_seconds;
+    };
+  };
+  return stats;
+};
+
+/*
+  Receive thread of a multi-board receive (see ODILEServer::launchDemux). Drains datagrams from all the boards with recvmmsg(), looks each sender up in the source table and writes the datagram to that board's sink.
+*/
+void * asyncDemux(void *args) {
+  demux_arg_t* arg=(demux_arg_t*) args;
+  std::string ifname=arg->opts.interface.empty() ? PacketSocket::findInterface(arg->ip_address) : arg->opts.interface;
+  applyThreadPolicy(arg->opts.receive_policy, ifname);
+  try {
+    udp_server data_server(arg->ip_address, arg->port);
+    if (arg->opts.rcvbuf_bytes > 0) {
+      data_server.set_rcvbuf(arg->opts.rcvbuf_bytes);
+    };
+    data_server.enable_drop_count();
+    if (arg->opts.busy_poll_us > 0) {
+      data_server.enable_busy_poll(arg->opts.busy_poll_us);
+    };
+    PacketBatch batch(arg->opts.batch_size, arg->datagram_bytes);
+    while (!arg->stop) {
+      int npackets=batch.recv(data_server, arg->opts.timeout_ms);
+      arg->ndropped=batch.dropCount();
+      for (int i=0; i < npackets; i++) {
+	int board=arg->sources->find(batch.sourceAddress(i));
+	if (board < 0) {
+	  arg->nstrays++;
+	  continue;
+	};
+	board_sink_t *sink=arg->boards[board];
+	if (batch.truncated(i)) {
+	  arg->ntruncated++;
+	};
+	char *data=batch.data(i);
+	int packet_len=batch.length(i);
+	sink->npackets++;
+	if (arg->opts.track_sequence && packet_len >= 4) {
+	  uint32_t app_header=ntohl(*(uint32_t *)data);
+	  data+=4;
+	  packet_len-=4;
+	  if (!sink->tracker.check(app_header, packet_len/4, sink->nread)) continue;
+	};
+	sink->writer.write(data, packet_len);
+	sink->nread+=packet_len/4;
+      };
+    };
+    int ndropped=data_server.get_drop_count();
+    if (ndropped > arg->ndropped) {
+      arg->ndropped=ndropped;
+    };
+  } catch (std::runtime_error &e) {
+    std::cout << "Error starting multi-board receive on port 0x" << std::hex << arg->port << std::dec << ": " << e.what() << std::endl;
+  };
+  if (arg->ndropped > 0) {
+    std::cout << "Warning: kernel dropped " << arg->ndropped << " packets on port 0x" << std::hex << arg->port << std::dec << std::endl;
+  };
+  if (arg->ntruncated > 0) {
+    std::cout << "Warning: " << arg->ntruncated << " packets on port 0x" << std::hex << arg->port << std::dec << " were larger than the " << arg->datagram_bytes << " byte receive buffers and got cut short (check ENET_PacketSize)." << std::endl;
+  };
+  for (unsigned int i=0; i < arg->boards.size(); i++) {
+    if (arg->opts.track_sequence) {
+      std::cout << "Sequence check of board " << arg->boards[i]->address << ":" << std::endl;
+      arg->boards[i]->tracker.report(std::cout);
+    };
+    arg->boards[i]->writer.close();
+  };
+  arg->finished=true;
+  return NULL;
+};
+
+/*
+  Starts receiving from several boards that all send to port, on one socket and one thread, instead of one ODILEServer per board. Returns a handle for closeDemux() and getDemuxStats().
+  boards holds the boards' IP addresses, and outfiles the file each board's data is written to (in the same order). Datagrams are told apart by their source address, and those from any other sender are counted and dropped.
+  Of opts, the batch size, timeout, receive buffer size, busy polling, sequence tracking (per board) and receive policy apply; the packets are written from the receive thread.
+*/
+int ODILEServer::launchDemux(std::vector<std::string> boards, std::vector<std::string> outfiles, std::string serv_address, int port, int nrows, int ncols, async_opts_t opts) {
+  if (boards.empty() || boards.size() != outfiles.size()) {
+    std::cout << "Error: need one output file per board." << std::endl;
+    return -1;
+  };
+  demux_arg_t* demux=new demux_arg_t;
+  demux->stop=false;
+  demux->finished=false;
+  demux->port=port;
+  demux->ip_address=serv_address==NULL_IPADDRESS ? server_address : serv_address;
+  demux->sources=new SourceTable(boards.size());
+  demux->nstrays=0;
+  demux->ndropped=0;
+  //The boards are configured alike, so the loaded configuration describes all of them
+  demux->datagram_bytes=datagramBytes(port);
+  demux->ntruncated=0;
+  demux->opts=opts;
+  for (unsigned int i=0; i < boards.size(); i++) {
+    struct in_addr addr;
+    if (inet_pton(AF_INET, boards[i].c_str(), &addr) != 1 || !demux->sources->add(addr.s_addr, demux->boards.size())) {
+      std::cout << "Warning: ignoring board address '" << boards[i] << "' (not an IPv4 address, or given twice)." << std::endl;
+      continue;
+    };
+    board_sink_t *sink=new board_sink_t;
+    sink->address=boards[i];
+    sink->outfname=outfiles[i];
+    sink->nread=0;
+    sink->npackets=0;
+    sink->writer.open(outfiles[i], nrows, ncols);
+    demux->boards.push_back(sink);
+  };
+  demux_args.push_back(demux);
+  pthread_t thread;
+  pthread_create(&thread, NULL, asyncDemux, demux);
+  demux_threads.push_back(thread);
+  return demux_args.size()-1;
+};
+
+//Stops a multi-board receive and returns the number of words written for all boards.
+int ODILEServer::closeDemux(int demux_id) {
+  if (demux_id < 0 || demux_id >= int(demux_args.size()) || demux_args[demux_id]==NULL) return -1;
+  demux_arg_t* demux=demux_args[demux_id];
+  demux->stop=true;
+  pthread_join(demux_threads[demux_id], NULL);
+  int nwords=0;
+  for (unsigned int i=0; i < demux->boards.size(); i++) {
+    nwords+=demux->boards[i]->nread;
+    delete demux->boards[i];
+  };
+  delete demux->sources;
+  delete demux;
+  demux_args[demux_id]=NULL;
+  return nwords;
+};
+
+//Gets the words and packets received from each board of a multi-board receive, and the datagrams from other senders. Works until it is closed.
+demux_stats_t ODILEServer::getDemuxStats(int demux_id) {
+  demux_stats_t stats;
+  if (demux_id < 0 || demux_id >= int(demux_args.size()) || demux_args[demux_id]==NULL) return stats;
+  demux_arg_t* demux=demux_args[demux_id];
+  for (unsigned int i=0; i < demux->boards.size(); i++) {
+    board_stats_t board;
+    board.address=demux->boards[i]->address;
+    board.words=demux->boards[i]->nread;
+    board.packets=demux->boards[i]->npackets;
+    board.sequence=demux->boards[i]->tracker.getStats();
+    stats.boards.push_back(board);
+  };
+  stats.strays=demux->nstrays;
+  stats.dropped=demux->ndropped;
+  stats.finished=demux->finished;
+  return stats;
+};
+
 /*
   Writes firmware to the ODILE flash memory. 
 
   fname : a .rpd file that contains the new firmware to write to the ODILE. This firmware should be compressed so that it fits in less than half the flash (allowing two firmware version to be written simultaneously).
   mapfname :  a .map file for the .rpd file that specifies the length of the firmware. 
   start_address : the 32-bit integer start address of the firmware (usually this will be either 0x00000000, to overwrite the factory firmware, or0x01000000, to update the application firmware). No other addresses should be used in typical operation.
+
+  Returns 0 once every page reads back as written, -1 if start_address is not on a sector boundary, -2 if a page did not read back as written, or -3 if a command failed or got no reply within COMMAND_TIMEOUT_MS.
 */
 int ODILEServer::writeFirmware(std::string fname, std::string mapfname, uint32_t start_address) {
   using namespace epcq_consts;
@@ -432,21 +2067,25 @@ int ODILEServer::writeFirmware(std::string fname, std::string mapfname, uint32_t
     return -1;
   };
   bool done;
+  //Bind the read-back port before any page is requested, so no page can arrive while nothing listens
+  openReceiveSocket(FIRMWARE_PORT);
   //Clear write buffers to start
   sendCommand("ERB");
   //bool done=waitForDone("ERB",-1);
   int sector_idx=-1;
   for (int page_idx=0; page_idx < pages_to_write; page_idx++) {
-    //Set address
-    sendCommand("ESA",0,curr_address);
-    done=waitForDone("ESA",-1);
-    //return 0; //temp
     if (curr_address % SECTOR_BYTES == 0 ) {
       sector_idx++;			
       //std::cout << "Writing sector " << sector_idx << " out of " << sectors_to_write << "...";
-      //Erase sector		
-      sendCommand("ESE");
-      done=waitForDone("ESE",-1);
+      //Set address and erase sector. The write has to wait for the erase to finish.
+      queueCommand("ESA",0,curr_address,COMMAND_TIMEOUT_MS);
+      queueCommand("ESE",0,0xFFFFFFFF,COMMAND_TIMEOUT_MS);
+      done=flushCommands(COMMAND_TIMEOUT_MS)==0;
+      if (!done) {
+	std::cout << std::endl;
+	std::cout << "Error, erase of sector " << sector_idx << " failed or got no reply" << std::endl;
+	return -3;
+      };
       //std::cout << "erase done. Beginning write..." << std::endl;
     };
     //Now write our pages
@@ -456,18 +2095,28 @@ int ODILEServer::writeFirmware(std::string fname, std::string mapfname, uint32_t
       write_page[word_idx]=bswap_32(word);
       //write_page[word_idx]=word;
     }
-    //Set our address
-    sendCommand("ESA",0,curr_address);
-    done=waitForDone("ESA",-1);
-    //Send data to our write buffer
+    //Set our address, send data to our write buffer and execute the write, without waiting for the replies in between
+    queueCommand("ESA",0,curr_address,COMMAND_TIMEOUT_MS);
     sendData(write_page,FIRMWARE_PORT);
-    //Execute write command
-    sendCommand("EWR",PAGE_SIZE_WORDS);
-    done=waitForDone("EWR",-1);
+    queueCommand("EWR",PAGE_SIZE_WORDS,0xFFFFFFFF,COMMAND_TIMEOUT_MS);
+    //The read back has to wait for the write to finish
+    done=flushCommands(COMMAND_TIMEOUT_MS)==0;
+    if (!done) {
+      std::cout << std::endl;
+      std::cout << "Error, write of sector " << sector_idx << ", page " << page_idx << " failed or got no reply" << std::endl;
+      return -3;
+    };
     //Now read back what we just wrote
-    sendCommand("ERD",PAGE_SIZE_WORDS);
-    recieveData(&read_page,FIRMWARE_PORT,-1, false);
+    queueCommand("ERD",PAGE_SIZE_WORDS,0xFFFFFFFF,COMMAND_TIMEOUT_MS);
+    recieveData(&read_page,FIRMWARE_PORT,COMMAND_TIMEOUT_MS, false);
+    if (read_page.size() != write_page.size()) {
+      flushCommands(COMMAND_TIMEOUT_MS);
+      std::cout << std::endl;
+      std::cout << "Error, read back of sector " << sector_idx << ", page " << page_idx << " failed or got no reply (" << read_page.size() << " words)" << std::endl;
+      return -3;
+    };
     if (read_page != write_page) {
+      flushCommands(COMMAND_TIMEOUT_MS);
       std::cout << std::endl;
       std::cout << "Error, read back data does not match written data for sector: " << sector_idx << ", page: " << page_idx << std::endl;
       std::cout << "Sizes are: " << write_page.size() << ":" << read_page.size() << std::endl;
@@ -496,7 +2145,13 @@ int ODILEServer::writeFirmware(std::string fname, std::string mapfname, uint32_t
     std::cout.flush();
     /*************************************************************/
   }
+  done=flushCommands(COMMAND_TIMEOUT_MS)==0;
   std::cout << std::endl;
+  if (!done) {
+    std::cout << "Error, the last page read back failed or got no reply" << std::endl;
+    return -3;
+  };
+  return 0;
 }
 
 /*
@@ -513,6 +2168,7 @@ int ODILEServer::readEPCQ(std::string ofname, uint32_t start_address, int words_
   uint32_t curr_address=start_address;
   outfile.open(ofname,std::ios::binary | std::ios::out);
   bool done;
+  openReceiveSocket(FIRMWARE_PORT);
   std::cout << "Clearing buffers...";
   sendCommand("ERB");
   done=waitForDone("ERB",-1);
@@ -522,23 +2178,37 @@ int ODILEServer::readEPCQ(std::string ofname, uint32_t start_address, int words_
   int words_read=0;
   std::vector<uint32_t> read_page;
   std::cout << "Starting read from address 0x" <<std::hex << start_address<< " ";
-  sendCommand("ESA", 0, start_address);
-  done=waitForDone("ESA",-1);
+  //The address and read commands are pipelined: each read only has to wait for its page to arrive
+  queueCommand("ESA", 0, start_address, COMMAND_TIMEOUT_MS);
   for (int i=0; i < pages_to_read;i++) {
     //Read our data
-    sendCommand("ERD",PAGE_SIZE_WORDS);
-    recieveData(&read_page,FIRMWARE_PORT,-1,false);
+    queueCommand("ERD",PAGE_SIZE_WORDS,0xFFFFFFFF,COMMAND_TIMEOUT_MS);
+    recieveData(&read_page,FIRMWARE_PORT,COMMAND_TIMEOUT_MS,false);
+    if (int(read_page.size()) < PAGE_SIZE_WORDS) {
+      std::cout << std::endl;
+      std::cout << "Warning: the page at 0x" << curr_address << " failed or got no reply (" << std::dec << read_page.size() << " words), its data is left as 0." << std::hex << std::endl;
+      read_page.resize(PAGE_SIZE_WORDS, 0);
+    };
     //write to file
     outfile.write((char *)&read_page[0],PAGE_SIZE_BYTES);
     curr_address+=PAGE_SIZE_BYTES;
-    sendCommand("ESA",0,curr_address);
-    done=waitForDone("ESA",-1);
+    queueCommand("ESA",0,curr_address,COMMAND_TIMEOUT_MS);
     words_left-= PAGE_SIZE_WORDS;
     words_read+=PAGE_SIZE_WORDS;
     read_page.clear();
   };
-  sendCommand("ERD",words_left);
-  recieveData(&read_page,FIRMWARE_PORT,-1,false);
+  queueCommand("ERD",words_left,0xFFFFFFFF,COMMAND_TIMEOUT_MS);
+  recieveData(&read_page,FIRMWARE_PORT,COMMAND_TIMEOUT_MS,false);
+  done=flushCommands(COMMAND_TIMEOUT_MS)==0;
+  if (int(read_page.size()) < words_left) {
+    std::cout << std::endl;
+    std::cout << "Warning: the page at 0x" << curr_address << " failed or got no reply (" << std::dec << read_page.size() << " words), its data is left as 0." << std::hex << std::endl;
+    read_page.resize(words_left, 0);
+  };
+  if (!done) {
+    std::cout << std::endl;
+    std::cout << "Warning: a flash address or read command failed or got no reply, the data read may be wrong." << std::endl;
+  };
   //write to file
   outfile.write((char *)&read_page[0],words_left);
   words_read+=words_left;
@@ -552,7 +2222,7 @@ int ODILEServer::readEPCQ(std::string ofname, uint32_t start_address, int words_
   start_address : start address to begin writing to. The data address will increment upwards from this automatically.
   perform_erase : whether to erase the sector containing start_address or not. Flash memory must be erase before a write, attempting to write to non-erase addresses will result in data corruption. The EPCQ in the ODILE board can only be erased on the sector level. It is the responsibility of the user to ensure they are writing to erased addresses.
 
-  Returns the number of 32-bit words written.
+  Returns the number of 32-bit words written, -2 if a page did not read back as written, or -3 if a command failed or got no reply within COMMAND_TIMEOUT_MS.
 */
 int ODILEServer::writeEPCQ(std::vector<uint32_t> data, uint32_t start_address, bool perform_erase) {
   using namespace epcq_consts;
@@ -566,18 +2236,23 @@ int ODILEServer::writeEPCQ(std::vector<uint32_t> data, uint32_t start_address, b
   uint32_t end_address=bytes_to_write+start_address;
   int words_written=0;
   bool done;	
+  openReceiveSocket(FIRMWARE_PORT);
   //Clear our buffer
   sendCommand("ERB");
   done=waitForDone("ERB",-1);
   //Set start address
-  sendCommand("ESA",0,start_address);
-  done=waitForDone("ESA",-1);
+  queueCommand("ESA",0,start_address,COMMAND_TIMEOUT_MS);
   //Perform our erase first.
   if (perform_erase) {
     //Erase sector
     std::cout << "Performing sector erase...";
-    sendCommand("ESE");
-    done=waitForDone("ESE",-1);
+    queueCommand("ESE",0,0xFFFFFFFF,COMMAND_TIMEOUT_MS);
+    done=flushCommands(COMMAND_TIMEOUT_MS)==0;
+    if (!done) {
+      std::cout << std::endl;
+      std::cout << "Error, sector erase failed or got no reply" << std::endl;
+      return -3;
+    };
     std::cout << "erase done. Beginning write..." << std::endl;
   };
   //Index for current data word
@@ -596,19 +2271,27 @@ int ODILEServer::writeEPCQ(std::vector<uint32_t> data, uint32_t start_address, b
       }
       data_idx++;
     };
-    //Set our address
-    sendCommand("ESA",0,curr_address);
-    done=waitForDone("ESA",-1);
-    //Send data to our write buffer
+    //Set our address, send data to our write buffer and execute the write, without waiting for the replies in between
+    queueCommand("ESA",0,curr_address,COMMAND_TIMEOUT_MS);
     sendData(write_page,FIRMWARE_PORT);
-    //Execute write command
-    sendCommand("EWR",PAGE_SIZE_WORDS);
-    done=waitForDone("EWR",-1);
+    queueCommand("EWR",PAGE_SIZE_WORDS,0xFFFFFFFF,COMMAND_TIMEOUT_MS);
+    //The read back has to wait for the write to finish
+    done=flushCommands(COMMAND_TIMEOUT_MS)==0;
+    if (!done) {
+      std::cout << "Error, write to address " << curr_address << " failed or got no reply" << std::endl;
+      return -3;
+    };
     words_written+=PAGE_SIZE_WORDS;
     //Now read back what we just wrote
-    sendCommand("ERD",PAGE_SIZE_WORDS);
-    recieveData(&read_page,FIRMWARE_PORT,-1, false);
+    queueCommand("ERD",PAGE_SIZE_WORDS,0xFFFFFFFF,COMMAND_TIMEOUT_MS);
+    recieveData(&read_page,FIRMWARE_PORT,COMMAND_TIMEOUT_MS, false);
+    if (read_page.size() != write_page.size()) {
+      flushCommands(COMMAND_TIMEOUT_MS);
+      std::cout << "Error, read back of address " << curr_address << " failed or got no reply (" << read_page.size() << " words)" << std::endl;
+      return -3;
+    };
     if (read_page != write_page) {
+      flushCommands(COMMAND_TIMEOUT_MS);
       std::cout << "Error, read back data does not match written data for address: "<< curr_address << std::endl;
       std::cout << "Sizes are: " << write_page.size() << ":" << read_page.size() << std::endl;
       if (write_page.size() == read_page.size()) {
@@ -621,6 +2304,10 @@ int ODILEServer::writeEPCQ(std::vector<uint32_t> data, uint32_t start_address, b
     read_page.clear();
     curr_address+=PAGE_SIZE_BYTES;		
   }
+  if (flushCommands(COMMAND_TIMEOUT_MS) != 0) {
+    std::cout << "Error, the last page read back failed or got no reply" << std::endl;
+    return -3;
+  };
   return words_written;
 }
 /*
@@ -0,0 +1,70 @@
+#include "PacketBatch.hpp"
+
+#include <string.h>
+#include <time.h>
+#include <linux/errqueue.h>
+
+PacketBatch::PacketBatch(int nslots, int slot_size) : nslots(nslots > 0 ? nslots : 1), slot_size(slot_size), drop_count(0) {
+  buffers=new char[this->nslots*slot_size];
+  control=new char[this->nslots*PACKET_CONTROL_SIZE];
+  msgs=new struct mmsghdr[this->nslots];
+  iovecs=new struct iovec[this->nslots];
+  timestamps=new slot_time_t[this->nslots];
+  segment_sizes=new int[this->nslots];
+  names=new struct sockaddr_in[this->nslots];
+  memset(names, 0, this->nslots*sizeof(struct sockaddr_in));
+  memset(msgs, 0, this->nslots*sizeof(struct mmsghdr));
+  //Each slot gets its own fixed region of the buffer
+  for (int i=0; i < this->nslots; i++) {
+    iovecs[i].iov_base=buffers+i*slot_size;
+    iovecs[i].iov_len=slot_size;
+    msgs[i].msg_hdr.msg_iov=&iovecs[i];
+    msgs[i].msg_hdr.msg_iovlen=1;
+    msgs[i].msg_hdr.msg_control=control+i*PACKET_CONTROL_SIZE;
+    msgs[i].msg_hdr.msg_name=&names[i];
+  };
+};
+
+PacketBatch::~PacketBatch() {
+  delete[] names;
+  delete[] segment_sizes;
+  delete[] timestamps;
+  delete[] iovecs;
+  delete[] msgs;
+  delete[] control;
+  delete[] buffers;
+};
+
+int PacketBatch::recv(udp_client_server::udp_server &server, int timeout_ms, int max) {
+  if (max <= 0 || max > nslots) {
+    max=nslots;
+  };
+  //The kernel overwrites the control and address lengths on every call
+  for (int i=0; i < max; i++) {
+    msgs[i].msg_hdr.msg_controllen=PACKET_CONTROL_SIZE;
+    msgs[i].msg_hdr.msg_namelen=sizeof(struct sockaddr_in);
+  };
+  int npackets=server.timed_recvmmsg(msgs, max, timeout_ms);
+  if (npackets <= 0) return 0;
+  for (int i=0; i < npackets; i++) {
+    timestamps[i].software=0;
+    timestamps[i].hardware=0;
+    segment_sizes[i]=0;
+    for (struct cmsghdr *cmsg=CMSG_FIRSTHDR(&msgs[i].msg_hdr); cmsg!=NULL; cmsg=CMSG_NXTHDR(&msgs[i].msg_hdr, cmsg)) {
+      if (cmsg->cmsg_level==SOL_SOCKET && cmsg->cmsg_type==SO_RXQ_OVFL) {
+	//Cumulative counter, so keep the latest value
+	drop_count=*(uint32_t*)CMSG_DATA(cmsg);
+      } else if (cmsg->cmsg_level==SOL_SOCKET && cmsg->cmsg_type==SCM_TIMESTAMPNS) {
+	struct timespec *ts=(struct timespec*)CMSG_DATA(cmsg);
+	timestamps[i].software=ts->tv_sec*1000000000LL+ts->tv_nsec;
+      } else if (cmsg->cmsg_level==SOL_SOCKET && cmsg->cmsg_type==SCM_TIMESTAMPING) {
+	struct scm_timestamping *tss=(struct scm_timestamping*)CMSG_DATA(cmsg);
+	timestamps[i].software=tss->ts[0].tv_sec*1000000000LL+tss->ts[0].tv_nsec;
+	timestamps[i].hardware=tss->ts[2].tv_sec*1000000000LL+tss->ts[2].tv_nsec;
+      } else if (cmsg->cmsg_level==SOL_UDP && cmsg->cmsg_type==UDP_GRO) {
+	segment_sizes[i]=*(int*)CMSG_DATA(cmsg);
+      };
+    };
+  };
+  return npackets;
+};
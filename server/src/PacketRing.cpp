@@ -0,0 +1,125 @@
+#include "PacketRing.hpp"
+
+#include <sched.h>
+#include <unistd.h>
+#include <time.h>
+
+//Number of polls before we start yielding, and before we start sleeping
+#define RING_SPIN_COUNT 100
+#define RING_YIELD_COUNT 1000
+#define RING_SLEEP_US 50
+
+void PacketRing::backoff(int &npolls) {
+  npolls++;
+  if (npolls < RING_SPIN_COUNT) {
+    return;
+  } else if (npolls < RING_YIELD_COUNT) {
+    sched_yield();
+  } else {
+    usleep(RING_SLEEP_US);
+  }
+}
+
+static double monotonicMs() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec*1000.0+ts.tv_nsec/1.0e6;
+}
+
+PacketRing::PacketRing(int nslots, int slot_size) : slot_size(slot_size), head(0), head_local(0), tail(0), tail_local(0), closed(false) {
+  //Round up to a power of two so we can mask the indices
+  this->nslots=1;
+  while (this->nslots < nslots) {
+    this->nslots*=2;
+  };
+  mask=this->nslots-1;
+  storage=new char[(long)this->nslots*slot_size];
+  slots=new packet_slot_t[this->nslots];
+  for (int i=0; i < this->nslots; i++) {
+    slots[i].data=storage+(long)i*slot_size;
+    slots[i].len=0;
+    slots[i].release=NULL;
+    slots[i].release_ctx=NULL;
+    slots[i].app_header=0;
+  };
+  stats.capacity=this->nslots;
+};
+
+PacketRing::~PacketRing() {
+  delete[] slots;
+  delete[] storage;
+};
+
+int PacketRing::waitFree() {
+  int npolls=0;
+  double stall_start=0;
+  while (true) {
+    int nfree=nslots-int(head_local-tail.load(std::memory_order_acquire));
+    if (nfree > 0) {
+      if (npolls > 0) {
+	stats.stall_ms+=monotonicMs()-stall_start;
+      };
+      return nfree;
+    };
+    //The writer has fallen behind
+    if (npolls==0) {
+      stats.stalls++;
+      stall_start=monotonicMs();
+    };
+    backoff(npolls);
+  };
+};
+
+void PacketRing::publish(int n) {
+  if (n <= 0) return;
+  head_local+=n;
+  head.store(head_local, std::memory_order_release);
+  int used=int(head_local-tail.load(std::memory_order_relaxed));
+  if (used > stats.high_water) {
+    stats.high_water=used;
+  };
+};
+
+void PacketRing::waitEmpty() {
+  int npolls=0;
+  while (head_local != tail.load(std::memory_order_acquire)) {
+    backoff(npolls);
+  };
+};
+
+void PacketRing::close() {
+  closed.store(true, std::memory_order_release);
+};
+
+int PacketRing::waitFilled() {
+  int npolls=0;
+  while (true) {
+    //Check the closed flag first, so we can't miss packets published just before closing
+    bool is_closed=closed.load(std::memory_order_acquire);
+    int nfilled=int(head.load(std::memory_order_acquire)-tail_local);
+    if (nfilled > 0) {
+      return nfilled;
+    };
+    if (is_closed) {
+      return 0;
+    };
+    backoff(npolls);
+  };
+};
+
+int PacketRing::pollFilled(bool *drained) {
+  bool is_closed=closed.load(std::memory_order_acquire);
+  int nfilled=int(head.load(std::memory_order_acquire)-tail_local);
+  *drained=(is_closed && nfilled==0);
+  return nfilled;
+};
+
+void PacketRing::release(int n) {
+  if (n <= 0) return;
+  tail_local+=n;
+  tail.store(tail_local, std::memory_order_release);
+};
+
+ring_stats_t PacketRing::getStats() {
+  return stats;
+};
@@ -0,0 +1,167 @@
+#include "PacketSocket.hpp"
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <ifaddrs.h>
+#include <net/if.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <linux/if_ether.h>
+#include <linux/filter.h>
+#include <atomic>
+
+#define ETH_HEADER_BYTES 14
+#define IP_HEADER_BYTES 20
+#define UDP_HEADER_BYTES 8
+
+PacketSocket::PacketSocket(std::string ifname, const uint8_t board_mac[6], uint16_t header_config, int port, int block_size, int block_count)
+  : ring(NULL), ring_size(0), block_count(block_count), block_size(block_size), curr_block(0), header_config(header_config), port(port), ndropped(0) {
+  f_socket=socket(AF_PACKET, SOCK_RAW | SOCK_CLOEXEC, htons(ETH_P_ALL));
+  if (f_socket < 0) {
+    throw packet_socket_runtime_error("could not create AF_PACKET socket (requires CAP_NET_RAW): "+std::string(strerror(errno)));
+  }
+  //Only wake up for frames sent by the board: compare the source MAC (bytes 6-11 of the frame)
+  uint32_t mac_hi=(board_mac[0]<<24) | (board_mac[1]<<16) | (board_mac[2]<<8) | board_mac[3];
+  uint32_t mac_lo=(board_mac[4]<<8) | board_mac[5];
+  struct sock_filter code[]={
+    BPF_STMT(BPF_LD | BPF_W | BPF_ABS, 6),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, mac_hi, 0, 3),
+    BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 10),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, mac_lo, 0, 1),
+    BPF_STMT(BPF_RET | BPF_K, 0xFFFFFFFF),
+    BPF_STMT(BPF_RET | BPF_K, 0),
+  };
+  struct sock_fprog filter;
+  filter.len=sizeof(code)/sizeof(code[0]);
+  filter.filter=code;
+  int version=TPACKET_V3;
+  struct tpacket_req3 req;
+  memset(&req, 0, sizeof(req));
+  req.tp_block_size=block_size;
+  req.tp_block_nr=block_count;
+  req.tp_frame_size=TPACKET_ALIGNMENT << 7;
+  req.tp_frame_nr=(block_size/req.tp_frame_size)*block_count;
+  req.tp_retire_blk_tov=PACKET_BLOCK_TIMEOUT_MS;
+  std::string error;
+  if (setsockopt(f_socket, SOL_SOCKET, SO_ATTACH_FILTER, &filter, sizeof(filter)) != 0) {
+    error="could not attach MAC filter";
+  } else if (setsockopt(f_socket, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) != 0) {
+    error="TPACKET_V3 not supported";
+  } else if (setsockopt(f_socket, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) != 0) {
+    error="could not create receive ring (block size must be a multiple of the page size)";
+  } else {
+    ring_size=(size_t)block_size*block_count;
+    void *map=mmap(NULL, ring_size, PROT_READ | PROT_WRITE, MAP_SHARED, f_socket, 0);
+    if (map==MAP_FAILED) {
+      error="could not map receive ring";
+    } else {
+      ring=(char *)map;
+      struct sockaddr_ll addr;
+      memset(&addr, 0, sizeof(addr));
+      addr.sll_family=AF_PACKET;
+      addr.sll_protocol=htons(ETH_P_ALL);
+      addr.sll_ifindex=if_nametoindex(ifname.c_str());
+      if (addr.sll_ifindex==0) {
+	error="unknown interface \""+ifname+"\"";
+      } else if (bind(f_socket, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+	error="could not bind to interface \""+ifname+"\"";
+      }
+    }
+  }
+  if (!error.empty()) {
+    error+=": "+std::string(strerror(errno));
+    if (ring) munmap(ring, ring_size);
+    close(f_socket);
+    throw packet_socket_runtime_error(error);
+  }
+};
+
+PacketSocket::~PacketSocket() {
+  munmap(ring, ring_size);
+  close(f_socket);
+};
+
+struct tpacket_block_desc* PacketSocket::waitBlock(int timeout_ms) {
+  struct tpacket_block_desc *block=(struct tpacket_block_desc *)(ring+(size_t)curr_block*block_size);
+  if ((__atomic_load_n(&block->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER)==0) {
+    struct pollfd pfd;
+    pfd.fd=f_socket;
+    pfd.events=POLLIN | POLLERR;
+    pfd.revents=0;
+    poll(&pfd, 1, timeout_ms);
+    if ((__atomic_load_n(&block->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER)==0) {
+      return NULL;
+    }
+  }
+  curr_block=(curr_block+1) % block_count;
+  return block;
+};
+
+void PacketSocket::releaseBlock(void *block, char *data) {
+  __atomic_store_n(&((struct tpacket_block_desc *)block)->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+};
+
+struct tpacket3_hdr* PacketSocket::firstPacket(struct tpacket_block_desc *block) {
+  return (struct tpacket3_hdr *)((char *)block+block->hdr.bh1.offset_to_first_pkt);
+};
+
+struct tpacket3_hdr* PacketSocket::nextPacket(struct tpacket3_hdr *pkt) {
+  return (struct tpacket3_hdr *)((char *)pkt+pkt->tp_next_offset);
+};
+
+char* PacketSocket::payload(struct tpacket3_hdr *pkt, int *len) {
+  char *frame=(char *)pkt+pkt->tp_mac;
+  int frame_len=pkt->tp_snaplen;
+  int offset=ETH_HEADER_BYTES;
+  *len=0;
+  if (header_config & HEADER_CONFIG_IP) {
+    if (frame_len < offset+IP_HEADER_BYTES) return NULL;
+    //Trust the IP length over the frame length, to drop any Ethernet padding
+    uint16_t ip_len=ntohs(*(uint16_t *)(frame+offset+2));
+    if (offset+ip_len < frame_len) {
+      frame_len=offset+ip_len;
+    }
+    offset+=IP_HEADER_BYTES;
+  }
+  if (header_config & HEADER_CONFIG_UDP) {
+    if (frame_len < offset+UDP_HEADER_BYTES) return NULL;
+    uint16_t dest_port=ntohs(*(uint16_t *)(frame+offset+2));
+    if (dest_port != port) return NULL;
+    offset+=UDP_HEADER_BYTES;
+  }
+  //Only whole 32-bit words are data
+  *len=(frame_len-offset) & ~3;
+  return *len > 0 ? frame+offset : NULL;
+};
+
+int PacketSocket::getDropCount() {
+  //Reading the statistics resets them, so keep a running total
+  struct tpacket_stats_v3 stats;
+  socklen_t len=sizeof(stats);
+  if (getsockopt(f_socket, SOL_PACKET, PACKET_STATISTICS, &stats, &len)==0) {
+    ndropped+=stats.tp_drops;
+  }
+  return ndropped;
+};
+
+std::string PacketSocket::findInterface(std::string ip_address) {
+  struct ifaddrs *ifaddr;
+  std::string ifname;
+  struct in_addr addr;
+  if (inet_pton(AF_INET, ip_address.c_str(), &addr)!=1 || getifaddrs(&ifaddr)!=0) {
+    return ifname;
+  }
+  for (struct ifaddrs *ifa=ifaddr; ifa!=NULL; ifa=ifa->ifa_next) {
+    if (ifa->ifa_addr && ifa->ifa_addr->sa_family==AF_INET &&
+	((struct sockaddr_in *)ifa->ifa_addr)->sin_addr.s_addr==addr.s_addr) {
+      ifname=ifa->ifa_name;
+      break;
+    }
+  }
+  freeifaddrs(ifaddr);
+  return ifname;
+};
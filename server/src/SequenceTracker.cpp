@@ -0,0 +1,90 @@
+#include "SequenceTracker.hpp"
+
+#define SEQ_MASK ((1u << APP_SEQ_BITS)-1)
+//Sequence numbers less than half the counter range ahead of the expected one are in the future, the rest in the past
+#define SEQ_HALF (1u << (APP_SEQ_BITS-1))
+//How many of the latest loss ranges we search for a late frame
+#define SEQ_REORDER_WINDOW 64
+
+SequenceTracker::SequenceTracker() {
+};
+
+bool SequenceTracker::check(uint32_t app_header, int nwords, long word_offset) {
+  bool keep=checkFrame(app_header, nwords, word_offset);
+  published.publish(stats);
+  return keep;
+};
+
+bool SequenceTracker::checkFrame(uint32_t app_header, int nwords, long word_offset) {
+  int stream=APP_HEADER_STREAM(app_header);
+  uint32_t seq=APP_HEADER_SEQ(app_header);
+  stream_state_t &state=streams[stream];
+  if (!state.seen) {
+    //Streams may start at any count (the board counts from reset, not from the start of the image)
+    state.seen=true;
+    state.next_seq=(seq+1) & SEQ_MASK;
+    state.stats.frames++;
+    stats.frames++;
+    return true;
+  };
+  uint32_t ahead=(seq-state.next_seq) & SEQ_MASK;
+  if (ahead==0) {
+    state.next_seq=(seq+1) & SEQ_MASK;
+  } else if (ahead < SEQ_HALF) {
+    //Gap: frames next_seq to seq-1 are missing
+    loss_range_t range;
+    range.stream=stream;
+    range.first_seq=state.next_seq;
+    range.nframes=ahead;
+    range.word_offset=word_offset;
+    range.nwords=(long)ahead*nwords;
+    loss_map.push_back(range);
+    state.stats.gaps++;
+    state.stats.missing_frames+=ahead;
+    stats.gaps++;
+    stats.missing_frames+=ahead;
+    state.next_seq=(seq+1) & SEQ_MASK;
+  } else if (inGap(stream, seq)) {
+    state.stats.reorders++;
+    stats.reorders++;
+    return false;
+  } else {
+    state.stats.duplicates++;
+    stats.duplicates++;
+    return false;
+  };
+  state.stats.frames++;
+  stats.frames++;
+  return true;
+};
+
+bool SequenceTracker::inGap(int stream, uint32_t seq) {
+  int nsearched=0;
+  for (int i=int(loss_map.size())-1; i >= 0 && nsearched < SEQ_REORDER_WINDOW; i--) {
+    const loss_range_t &range=loss_map[i];
+    if (range.stream != stream) continue;
+    nsearched++;
+    uint32_t pos=(seq-range.first_seq) & SEQ_MASK;
+    if (pos >= range.nframes) continue;
+    //Late frames are not written, so the gap stays in the output (and in the lost frame count)
+    return true;
+  };
+  return false;
+};
+
+void SequenceTracker::report(std::ostream &out, int max_ranges) const {
+  for (int i=0; i < APP_MAX_STREAMS; i++) {
+    const seq_stats_t &s=streams[i].stats;
+    if (!streams[i].seen) continue;
+    out << "Stream " << i << ": " << s.frames << " frames, " << s.gaps << " gaps (" << s.missing_frames << " frames lost), "
+	<< s.duplicates << " duplicates, " << s.reorders << " reordered." << std::endl;
+  };
+  for (int i=0; i < int(loss_map.size()) && i < max_ranges; i++) {
+    const loss_range_t &r=loss_map[i];
+    out << "  Stream " << r.stream << ": frames " << r.first_seq << "-" << ((r.first_seq+r.nframes-1) & SEQ_MASK)
+	<< " missing at word " << r.word_offset << " (~" << r.nwords << " words)" << std::endl;
+  };
+  if (int(loss_map.size()) > max_ranges) {
+    out << "  ... " << loss_map.size()-max_ranges << " more gaps." << std::endl;
+  };
+};
@@ -0,0 +1,42 @@
+#include "SourceTable.hpp"
+
+#include <arpa/inet.h>
+
+SourceTable::SourceTable(int nboards) {
+  //A power of two at least twice the number of boards keeps the probe chains short
+  uint32_t size=8;
+  shift=32-3;
+  while (size < 2*(uint32_t)nboards) {
+    size*=2;
+    shift--;
+  };
+  keys.assign(size, 0);
+  values.assign(size, -1);
+  mask=size-1;
+};
+
+uint32_t SourceTable::slot(uint32_t addr) const {
+  //Boards usually differ in the last byte only. In host order that byte is the low one, which Fibonacci hashing spreads over the top bits of the product, so those make the slot index.
+  return (ntohl(addr)*2654435761u) >> shift;
+};
+
+bool SourceTable::add(uint32_t addr, int index) {
+  for (uint32_t i=slot(addr); ; i=(i+1) & mask) {
+    if (values[i] < 0) {
+      keys[i]=addr;
+      values[i]=index;
+      return true;
+    };
+    if (keys[i]==addr) {
+      return false;
+    };
+  };
+};
+
+int SourceTable::find(uint32_t addr) const {
+  for (uint32_t i=slot(addr); ; i=(i+1) & mask) {
+    if (values[i] < 0 || keys[i]==addr) {
+      return values[i];
+    };
+  };
+};
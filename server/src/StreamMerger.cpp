@@ -0,0 +1,174 @@
+#include "StreamMerger.hpp"
+#include "SequenceTracker.hpp"
+
+#include <time.h>
+
+#define MERGE_SEQ_MASK ((1u << APP_SEQ_BITS)-1)
+//Sequence numbers less than half the counter range ahead of the current one are in the future, the rest in the past
+#define MERGE_SEQ_HALF (1u << (APP_SEQ_BITS-1))
+
+static double monotonicMs() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec*1000.0+ts.tv_nsec/1.0e6;
+}
+
+StreamMerger::StreamMerger(int timeout_ms) : timeout_ms(timeout_ms), turn(0) {
+};
+
+StreamMerger::~StreamMerger() {
+  for (unsigned int i=0; i < rings.size(); i++) {
+    delete rings[i];
+  };
+};
+
+PacketRing* StreamMerger::addInput(int nslots, int slot_size) {
+  PacketRing *ring=new PacketRing(nslots, slot_size);
+  rings.push_back(ring);
+  done.push_back(false);
+  stalled.push_back(false);
+  first_seq.push_back(0);
+  aligned.push_back(false);
+  return ring;
+};
+
+void StreamMerger::releaseHead(int i) {
+  packet_slot_t &slot=rings[i]->consumerSlot(0);
+  if (slot.release) {
+    slot.release(slot.release_ctx, slot.data);
+  };
+  rings[i]->release(1);
+};
+
+uint32_t StreamMerger::expectedSeq(int i) {
+  return (first_seq[i]+turn) & MERGE_SEQ_MASK;
+};
+
+int StreamMerger::pollFrames(int i, bool *drained) {
+  int nfilled=rings[i]->pollFilled(drained);
+  while (nfilled > 0 && rings[i]->consumerSlot(0).len <= 0) {
+    releaseHead(i);
+    nfilled--;
+  };
+  return nfilled;
+};
+
+bool StreamMerger::start() {
+  int ninputs=inputs();
+  double first_ms=-1;
+  int npolls=0;
+  while (true) {
+    int nready=0;
+    bool have_seq=false;
+    for (int i=0; i < ninputs; i++) {
+      if (done[i] || aligned[i]) {
+	nready++;
+	have_seq=have_seq || aligned[i];
+	continue;
+      };
+      bool drained;
+      if (pollFrames(i, &drained) > 0) {
+	first_seq[i]=APP_HEADER_SEQ(rings[i]->consumerSlot(0).app_header);
+	aligned[i]=true;
+	have_seq=true;
+	nready++;
+      } else if (drained) {
+	done[i]=true;
+	nready++;
+      };
+    };
+    if (have_seq && first_ms < 0) {
+      first_ms=monotonicMs();
+    };
+    //Don't wait forever for an input that never delivers
+    if (nready==ninputs || (have_seq && monotonicMs()-first_ms > timeout_ms)) {
+      return have_seq;
+    };
+    PacketRing::backoff(npolls);
+  };
+};
+
+bool StreamMerger::othersWaiting(int i) {
+  for (int j=0; j < inputs(); j++) {
+    if (j==i || done[j]) continue;
+    bool drained;
+    if (rings[j]->pollFilled(&drained) > 0) {
+      return true;
+    };
+  };
+  return false;
+};
+
+void StreamMerger::mergeInput(int i, DataWriter &writer) {
+  int npolls=0;
+  double wait_start=-1;
+  while (true) {
+    bool drained;
+    int nfilled=pollFrames(i, &drained);
+    if (nfilled > 0) {
+      packet_slot_t &slot=rings[i]->consumerSlot(0);
+      if (!aligned[i]) {
+	//First frame of an input that was late to start: it joins at this turn
+	first_seq[i]=(APP_HEADER_SEQ(slot.app_header)-turn) & MERGE_SEQ_MASK;
+	aligned[i]=true;
+      };
+      stalled[i]=false;
+      uint32_t ahead=(APP_HEADER_SEQ(slot.app_header)-expectedSeq(i)) & MERGE_SEQ_MASK;
+      if (ahead==0) {
+	writer.write(slot.data, slot.len);
+	stats.frames++;
+	stats.words+=slot.len/4;
+	releaseHead(i);
+      } else if (ahead < MERGE_SEQ_HALF) {
+	//This input's frame for the current turn is missing, its oldest frame belongs to a later turn
+	stats.lost++;
+      } else {
+	//We already gave up on this frame
+	stats.late++;
+	releaseHead(i);
+	continue;
+      };
+      return;
+    };
+    if (drained) {
+      done[i]=true;
+      return;
+    };
+    //An input that has not sent anything yet has no frame to miss
+    if (!aligned[i]) {
+      return;
+    };
+    //Only give up on this input while the others have something to write, so an idle board doesn't count as loss.
+    //A full ring on another input only holds up its receive thread (the kernel buffers behind it), so it is no reason to give up sooner.
+    if (othersWaiting(i)) {
+      if (wait_start < 0) {
+	wait_start=monotonicMs();
+      };
+      if (stalled[i] || monotonicMs()-wait_start > timeout_ms) {
+	stalled[i]=true;
+	stats.lost++;
+	return;
+      };
+    } else {
+      wait_start=-1;
+    };
+    PacketRing::backoff(npolls);
+  };
+};
+
+void StreamMerger::run(DataWriter &writer) {
+  if (!start()) return;
+  while (true) {
+    bool open=false;
+    for (int i=0; i < inputs(); i++) {
+      if (done[i]) continue;
+      mergeInput(i, writer);
+      published.publish(stats);
+      if (!done[i]) {
+	open=true;
+      };
+    };
+    if (!open) return;
+    turn++;
+  };
+};
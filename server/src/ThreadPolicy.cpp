@@ -0,0 +1,128 @@
+#include "ThreadPolicy.hpp"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+//Largest NUMA node number we can ask for
+#define MAX_NUMA_NODES 64
+
+std::vector<int> parseCpuList(std::string list) {
+  std::vector<int> cpus;
+  std::stringstream ss(list);
+  std::string range;
+  while (std::getline(ss, range, ',')) {
+    char *end;
+    int first=strtol(range.c_str(), &end, 10);
+    if (end==range.c_str()) {
+      std::cout << "Warning: ignoring bad CPU list entry '" << range << "'" << std::endl;
+      continue;
+    };
+    int last=*end=='-' ? strtol(end+1, NULL, 10) : first;
+    for (int cpu=first; cpu <= last; cpu++) {
+      cpus.push_back(cpu);
+    };
+  };
+  return cpus;
+};
+
+int interfaceNumaNode(std::string ifname) {
+  std::ifstream node_file("/sys/class/net/"+ifname+"/device/numa_node");
+  int node=-1;
+  if (!(node_file >> node)) {
+    return -1;
+  };
+  return node;
+};
+
+//CPUs of a NUMA node, from sysfs
+static std::vector<int> nodeCpus(int node) {
+  std::ifstream cpulist_file("/sys/devices/system/node/node"+std::to_string(node)+"/cpulist");
+  std::string cpulist;
+  std::getline(cpulist_file, cpulist);
+  return parseCpuList(cpulist);
+};
+
+bool applyThreadPolicy(const thread_policy_t &policy, std::string ifname) {
+  bool ok=true;
+  int node=policy.numa_node;
+  if (node==NUMA_NODE_NIC) {
+    node=interfaceNumaNode(ifname);
+    if (node < 0) {
+      std::cout << "Warning: no NUMA node known for interface '" << ifname << "', leaving placement alone." << std::endl;
+      ok=false;
+    };
+  };
+  std::vector<int> cpus=policy.cpus;
+  if (node >= 0) {
+    if (cpus.empty()) {
+      cpus=nodeCpus(node);
+    };
+    //Allocate from the node first (falling back to others when it is full), so the rings end up next to the NIC
+    if (node < MAX_NUMA_NODES) {
+      unsigned long nodemask=1UL << node;
+      if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, &nodemask, MAX_NUMA_NODES+1) != 0) {
+	std::cout << "Warning: could not prefer memory from NUMA node " << node << ": " << strerror(errno) << std::endl;
+	ok=false;
+      };
+    };
+  };
+  if (!cpus.empty()) {
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    for (unsigned int i=0; i < cpus.size(); i++) {
+      if (cpus[i] >= 0 && cpus[i] < CPU_SETSIZE) {
+	CPU_SET(cpus[i], &cpuset);
+      };
+    };
+    int error=pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset);
+    if (error != 0) {
+      std::cout << "Warning: could not set CPU affinity: " << strerror(error) << std::endl;
+      ok=false;
+    };
+  };
+  if (policy.rt_priority > 0) {
+    struct sched_param param;
+    memset(&param, 0, sizeof(param));
+    param.sched_priority=policy.rt_priority;
+    int error=pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    if (error != 0) {
+      std::cout << "Warning: could not switch to SCHED_FIFO priority " << policy.rt_priority << ": " << strerror(error) << std::endl;
+      ok=false;
+    };
+  };
+  if (policy.lock_memory) {
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+      std::cout << "Warning: could not lock memory (check RLIMIT_MEMLOCK): " << strerror(errno) << std::endl;
+      ok=false;
+    };
+  };
+  return ok;
+};
+
+void saveThreadState(thread_sched_state_t *state) {
+  pthread_getaffinity_np(pthread_self(), sizeof(state->cpus), &state->cpus);
+  pthread_getschedparam(pthread_self(), &state->sched_policy, &state->param);
+  state->mem_nodes=0;
+  if (syscall(SYS_get_mempolicy, &state->mem_mode, &state->mem_nodes, MAX_NUMA_NODES+1, NULL, 0) != 0) {
+    state->mem_mode=MPOL_DEFAULT;
+  };
+};
+
+void restoreThreadState(const thread_sched_state_t &state) {
+  pthread_setaffinity_np(pthread_self(), sizeof(state.cpus), &state.cpus);
+  pthread_setschedparam(pthread_self(), state.sched_policy, &state.param);
+  if (state.mem_mode==MPOL_DEFAULT) {
+    syscall(SYS_set_mempolicy, MPOL_DEFAULT, NULL, 0);
+  } else {
+    syscall(SYS_set_mempolicy, state.mem_mode, &state.mem_nodes, MAX_NUMA_NODES+1);
+  };
+};
@@ -0,0 +1,59 @@
+#include "TokenBucket.hpp"
+
+#include <time.h>
+
+//Waits shorter than this are spun out, since a sleep would overshoot them
+#define SPIN_NS 50000
+
+static int64_t monotonicNs() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return int64_t(ts.tv_sec)*1000000000+ts.tv_nsec;
+};
+
+TokenBucket::TokenBucket(double rate, double depth) : words_per_second(rate), bucket_depth(depth), tokens(depth), waited_ns(0) {
+  last_ns=monotonicNs();
+};
+
+void TokenBucket::refill(int64_t now_ns) {
+  tokens+=(now_ns-last_ns)*words_per_second/1.0e9;
+  if (tokens > bucket_depth) {
+    tokens=bucket_depth;
+  };
+  last_ns=now_ns;
+};
+
+int TokenBucket::acquire(double cost, int max_units) {
+  //A send bigger than the whole buffer can't be split here, so it goes out into an empty one
+  double needed=cost < bucket_depth ? cost : bucket_depth;
+  int64_t now_ns=monotonicNs();
+  refill(now_ns);
+  if (tokens < needed) {
+    int64_t start_ns=now_ns;
+    int64_t ready_ns=now_ns+int64_t((needed-tokens)*1.0e9/words_per_second);
+    if (ready_ns-now_ns > SPIN_NS) {
+      timespec ts;
+      ts.tv_sec=(ready_ns-SPIN_NS)/1000000000;
+      ts.tv_nsec=(ready_ns-SPIN_NS)%1000000000;
+      clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+    };
+    while ((now_ns=monotonicNs()) < ready_ns) {
+    };
+    refill(now_ns);
+    waited_ns+=now_ns-start_ns;
+  };
+  int units=1;
+  tokens-=cost;
+  while (units < max_units && tokens >= cost) {
+    tokens-=cost;
+    units++;
+  };
+  return units;
+};
+
+void TokenBucket::refund(double cost, int units) {
+  tokens+=cost*units;
+  if (tokens > bucket_depth) {
+    tokens=bucket_depth;
+  };
+};
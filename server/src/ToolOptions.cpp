@@ -0,0 +1,48 @@
+#include "ToolOptions.hpp"
+
+#include <iostream>
+#include <sstream>
+#include <cstdlib>
+#include <ctime>
+
+double monotonicSeconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec+ts.tv_nsec*1e-9;
+};
+
+std::vector<double> parseNumberList(std::string list) {
+  std::vector<double> values;
+  std::stringstream ss(list);
+  std::string item;
+  while (std::getline(ss, item, ',')) {
+    if (item.empty()) continue;
+    //strtod() reads 0x as hex too
+    values.push_back(strtod(item.c_str(), NULL));
+  };
+  return values;
+};
+
+std::string parseInterface(std::string name) {
+  if (name=="sfp0") {
+    return "SFP0ConfigBlock";
+  } else if (name=="sfp1") {
+    return "SFP1ConfigBlock";
+  } else if (name!="rj45") {
+    std::cerr << "Unknown interface " << name << ", using rj45." << std::endl;
+  };
+  return "RJ45ConfigBlock";
+};
+
+AsyncBackend parseBackend(std::string name) {
+  if (name=="packet") {
+    return BACKEND_PACKET;
+  } else if (name=="uring") {
+    return BACKEND_URING;
+  } else if (name=="xdp") {
+    return BACKEND_XDP;
+  } else if (name!="udp") {
+    std::cerr << "Unknown backend " << name << ", using udp." << std::endl;
+  };
+  return BACKEND_UDP;
+};
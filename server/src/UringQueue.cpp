@@ -0,0 +1,222 @@
+#include "UringQueue.hpp"
+
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#ifdef URING_SUPPORTED
+
+static int uringSetup(unsigned entries, struct io_uring_params *p) {
+  return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int uringEnter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags, void *arg, size_t argsz) {
+  return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+static int uringRegister(int fd, unsigned opcode, void *arg, unsigned nr_args) {
+  return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+UringQueue::UringQueue(int entries, int nbufs, int buf_size)
+  : ring_fd(-1), sq_ptr(MAP_FAILED), sqes((struct io_uring_sqe *)MAP_FAILED),
+    buf_ring((struct io_uring_buf_ring *)MAP_FAILED), buffers(NULL), nbufs(nbufs), buf_size(buf_size) {
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  //Multishot receives can post many completions per submission
+  p.flags=IORING_SETUP_CQSIZE;
+  p.cq_entries=4*nbufs;
+  ring_fd=uringSetup(entries, &p);
+  if (ring_fd < 0) {
+    throw uring_runtime_error("io_uring_setup failed: "+std::string(strerror(errno)));
+  }
+  std::string error;
+  if ((p.features & IORING_FEAT_EXT_ARG)==0 || (p.features & IORING_FEAT_SINGLE_MMAP)==0) {
+    error="kernel io_uring is too old (no timeout on wait)";
+  } else {
+    //The submission and completion rings share one mapping
+    sq_size=p.sq_off.array+p.sq_entries*sizeof(unsigned);
+    cq_size=p.cq_off.cqes+p.cq_entries*sizeof(struct io_uring_cqe);
+    if (cq_size > sq_size) sq_size=cq_size;
+    sq_ptr=mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+    sqes_size=p.sq_entries*sizeof(struct io_uring_sqe);
+    sqes=(struct io_uring_sqe *)mmap(NULL, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+    if (sq_ptr==MAP_FAILED || sqes==MAP_FAILED) {
+      error="could not map io_uring queues";
+    }
+  }
+  if (error.empty()) {
+    char *sq=(char *)sq_ptr;
+    sq_head=(unsigned *)(sq+p.sq_off.head);
+    sq_tail=(unsigned *)(sq+p.sq_off.tail);
+    sq_array=(unsigned *)(sq+p.sq_off.array);
+    sq_mask=*(unsigned *)(sq+p.sq_off.ring_mask);
+    sq_entries=p.sq_entries;
+    sq_local_tail=*sq_tail;
+    cq_head=(unsigned *)(sq+p.cq_off.head);
+    cq_tail=(unsigned *)(sq+p.cq_off.tail);
+    cq_mask=*(unsigned *)(sq+p.cq_off.ring_mask);
+    cqes=(struct io_uring_cqe *)(sq+p.cq_off.cqes);
+    //Provided buffer ring: the descriptors must be page aligned, so map them
+    buf_ring_size=nbufs*sizeof(struct io_uring_buf);
+    buf_ring=(struct io_uring_buf_ring *)mmap(NULL, buf_ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr=(uint64_t)buf_ring;
+    reg.ring_entries=nbufs;
+    reg.bgid=0;
+    if (buf_ring==MAP_FAILED) {
+      error="could not allocate buffer ring";
+    } else if (uringRegister(ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+      error="kernel does not support provided buffer rings";
+    }
+  }
+  if (!error.empty()) {
+    error+=": "+std::string(strerror(errno));
+    cleanup();
+    throw uring_runtime_error(error);
+  }
+  buffers=new char[(long)nbufs*buf_size];
+  buf_ring->tail=0;
+  for (int i=0; i < nbufs; i++) {
+    recycleBuffer(i);
+  }
+};
+
+UringQueue::~UringQueue() {
+  cleanup();
+};
+
+void UringQueue::cleanup() {
+  if (buf_ring!=MAP_FAILED) munmap(buf_ring, buf_ring_size);
+  if (sqes!=MAP_FAILED) munmap(sqes, sqes_size);
+  if (sq_ptr!=MAP_FAILED) munmap(sq_ptr, sq_size);
+  if (ring_fd >= 0) close(ring_fd);
+  delete[] buffers;
+  buf_ring=(struct io_uring_buf_ring *)MAP_FAILED;
+  sqes=(struct io_uring_sqe *)MAP_FAILED;
+  sq_ptr=MAP_FAILED;
+  ring_fd=-1;
+  buffers=NULL;
+};
+
+struct io_uring_sqe* UringQueue::getSqe() {
+  unsigned head=__atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+  if (sq_local_tail-head >= sq_entries) {
+    return NULL;
+  }
+  unsigned idx=sq_local_tail & sq_mask;
+  struct io_uring_sqe *sqe=&sqes[idx];
+  memset(sqe, 0, sizeof(*sqe));
+  sq_array[idx]=idx;
+  sq_local_tail++;
+  return sqe;
+};
+
+bool UringQueue::submitAndWait(int min_complete, int timeout_ms) {
+  unsigned to_submit=sq_local_tail-*sq_tail;
+  __atomic_store_n(sq_tail, sq_local_tail, __ATOMIC_RELEASE);
+  struct __kernel_timespec ts;
+  ts.tv_sec=timeout_ms/1000;
+  ts.tv_nsec=(timeout_ms%1000)*1000000L;
+  struct io_uring_getevents_arg arg;
+  memset(&arg, 0, sizeof(arg));
+  arg.sigmask_sz=_NSIG/8;
+  arg.ts=(uint64_t)&ts;
+  int ret=uringEnter(ring_fd, to_submit, min_complete, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+  //EBUSY: the completion queue overflowed, the caller has to reap first
+  if (ret < 0 && errno!=ETIME && errno!=EINTR && errno!=EBUSY) {
+    throw uring_runtime_error("io_uring_enter failed: "+std::string(strerror(errno)));
+  }
+  return ret >= 0 || errno!=ETIME;
+};
+
+struct io_uring_cqe* UringQueue::peekCqe() {
+  unsigned head=*cq_head;
+  if (head==__atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) {
+    return NULL;
+  }
+  return &cqes[head & cq_mask];
+};
+
+void UringQueue::cqeSeen() {
+  __atomic_store_n(cq_head, *cq_head+1, __ATOMIC_RELEASE);
+};
+
+void UringQueue::prepRecvMultishot(int fd, uint64_t user_data) {
+  struct io_uring_sqe *sqe=getSqe();
+  if (sqe==NULL) {
+    throw uring_runtime_error("submission queue full");
+  }
+  sqe->opcode=IORING_OP_RECV;
+  sqe->fd=fd;
+  sqe->ioprio=IORING_RECV_MULTISHOT;
+  sqe->flags=IOSQE_BUFFER_SELECT;
+  sqe->buf_group=0;
+  sqe->user_data=user_data;
+};
+
+void UringQueue::prepCancel(uint64_t target, uint64_t user_data) {
+  struct io_uring_sqe *sqe=getSqe();
+  if (sqe==NULL) {
+    submitAndWait(0, 0);
+    sqe=getSqe();
+    if (sqe==NULL) {
+      throw uring_runtime_error("submission queue full");
+    }
+  }
+  sqe->opcode=IORING_OP_ASYNC_CANCEL;
+  sqe->fd=-1;
+  sqe->addr=target;
+  sqe->user_data=user_data;
+};
+
+void UringQueue::prepWrite(int fd, char *data, int len, uint64_t offset, uint64_t user_data) {
+  struct io_uring_sqe *sqe=getSqe();
+  if (sqe==NULL) {
+    //Push what we have to the kernel to make room
+    submitAndWait(0, 0);
+    sqe=getSqe();
+    if (sqe==NULL) {
+      throw uring_runtime_error("submission queue full");
+    }
+  }
+  sqe->opcode=IORING_OP_WRITE;
+  sqe->fd=fd;
+  sqe->addr=(uint64_t)data;
+  sqe->len=len;
+  sqe->off=offset;
+  sqe->user_data=user_data;
+};
+
+void UringQueue::recycleBuffer(int bid) {
+  unsigned short tail=buf_ring->tail;
+  //Not buf_ring->bufs: in C++ the kernel header's flex array macro moves it off the start of the ring
+  struct io_uring_buf *buf=(struct io_uring_buf *)buf_ring+(tail & (nbufs-1));
+  buf->addr=(uint64_t)bufferData(bid);
+  buf->len=buf_size;
+  buf->bid=bid;
+  __atomic_store_n(&buf_ring->tail, (unsigned short)(tail+1), __ATOMIC_RELEASE);
+};
+
+#else //URING_SUPPORTED
+
+UringQueue::UringQueue(int entries, int nbufs, int buf_size) {
+  throw uring_runtime_error("built without io_uring support");
+};
+
+UringQueue::~UringQueue() {};
+void UringQueue::cleanup() {};
+struct io_uring_sqe* UringQueue::getSqe() {return NULL;};
+bool UringQueue::submitAndWait(int min_complete, int timeout_ms) {return false;};
+struct io_uring_cqe* UringQueue::peekCqe() {return NULL;};
+void UringQueue::cqeSeen() {};
+void UringQueue::prepRecvMultishot(int fd, uint64_t user_data) {};
+void UringQueue::prepCancel(uint64_t target, uint64_t user_data) {};
+void UringQueue::prepWrite(int fd, char *data, int len, uint64_t offset, uint64_t user_data) {};
+void UringQueue::recycleBuffer(int bid) {};
+
+#endif //URING_SUPPORTED
@@ -0,0 +1,289 @@
+#include "XdpSocket.hpp"
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <net/if.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <arpa/inet.h>
+#include <linux/bpf.h>
+#include <linux/if_link.h>
+#include <vector>
+#include <cstddef>
+
+#ifndef AF_XDP
+#define AF_XDP 44
+#endif
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+//Offsets in the frames we steer: Ethernet header, 20 byte IPv4 header, then UDP
+#define XDP_IP_OFFSET 14
+#define XDP_UDP_OFFSET 34
+#define XDP_PAYLOAD_OFFSET 42
+//Completion ring, only used for transmitting
+#define XDP_COMP_RING_SIZE 64
+
+static int bpfSyscall(int cmd, union bpf_attr *attr) {
+  return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+//eBPF instruction encoders (the kernel's macros for these are not exported to user space)
+static struct bpf_insn bpfInsn(uint8_t code, uint8_t dst, uint8_t src, int16_t off, int32_t imm) {
+  struct bpf_insn insn;
+  insn.code=code;
+  insn.dst_reg=dst;
+  insn.src_reg=src;
+  insn.off=off;
+  insn.imm=imm;
+  return insn;
+}
+
+XdpSocket::XdpSocket(std::string ifname, int port, int queue_id, int nframes, bool native_mode)
+  : f_socket(-1), map_fd(-1), prog_fd(-1), link_fd(-1), umem((char *)MAP_FAILED), umem_size(0), nframes(nframes),
+    rx_map(MAP_FAILED), rx_cached_consumer(0), fill_map(MAP_FAILED), fill_cached_producer(0), comp_map(MAP_FAILED) {
+  int ifindex=if_nametoindex(ifname.c_str());
+  if (ifindex==0) {
+    throw xdp_socket_runtime_error("unknown interface \""+ifname+"\"");
+  }
+  std::string error;
+  f_socket=socket(AF_XDP, SOCK_RAW | SOCK_CLOEXEC, 0);
+  umem_size=(size_t)nframes*XDP_FRAME_SIZE;
+  if (f_socket < 0) {
+    error="could not create AF_XDP socket (requires CAP_NET_RAW and CAP_BPF)";
+  } else if ((umem=(char *)mmap(NULL, umem_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0))==MAP_FAILED) {
+    error="could not allocate UMEM";
+  } else {
+    struct xdp_umem_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.addr=(uint64_t)umem;
+    reg.len=umem_size;
+    reg.chunk_size=XDP_FRAME_SIZE;
+    int fill_size=nframes;
+    int comp_size=XDP_COMP_RING_SIZE;
+    int rx_size=nframes;
+    struct xdp_mmap_offsets off;
+    socklen_t optlen=sizeof(off);
+    if (setsockopt(f_socket, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg)) != 0) {
+      error="could not register UMEM";
+    } else if (setsockopt(f_socket, SOL_XDP, XDP_UMEM_FILL_RING, &fill_size, sizeof(fill_size)) != 0 ||
+	       setsockopt(f_socket, SOL_XDP, XDP_UMEM_COMPLETION_RING, &comp_size, sizeof(comp_size)) != 0 ||
+	       setsockopt(f_socket, SOL_XDP, XDP_RX_RING, &rx_size, sizeof(rx_size)) != 0) {
+      error="could not create AF_XDP rings (number of frames must be a power of two)";
+    } else if (getsockopt(f_socket, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen) != 0) {
+      error="could not get AF_XDP ring offsets";
+    } else {
+      rx_map_size=off.rx.desc+rx_size*sizeof(struct xdp_desc);
+      rx_map=mmap(NULL, rx_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, f_socket, XDP_PGOFF_RX_RING);
+      fill_map_size=off.fr.desc+fill_size*sizeof(uint64_t);
+      fill_map=mmap(NULL, fill_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, f_socket, XDP_UMEM_PGOFF_FILL_RING);
+      comp_map_size=off.cr.desc+comp_size*sizeof(uint64_t);
+      comp_map=mmap(NULL, comp_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, f_socket, XDP_UMEM_PGOFF_COMPLETION_RING);
+      if (rx_map==MAP_FAILED || fill_map==MAP_FAILED || comp_map==MAP_FAILED) {
+	error="could not map AF_XDP rings";
+      } else {
+	rx_producer=(uint32_t *)((char *)rx_map+off.rx.producer);
+	rx_consumer=(uint32_t *)((char *)rx_map+off.rx.consumer);
+	rx_descs=(struct xdp_desc *)((char *)rx_map+off.rx.desc);
+	fill_producer=(uint32_t *)((char *)fill_map+off.fr.producer);
+	fill_addrs=(uint64_t *)((char *)fill_map+off.fr.desc);
+	//Hand every frame to the kernel
+	for (int i=0; i < nframes; i++) {
+	  releaseFrame(this, umem+(size_t)i*XDP_FRAME_SIZE);
+	}
+	struct sockaddr_xdp addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sxdp_family=AF_XDP;
+	addr.sxdp_ifindex=ifindex;
+	addr.sxdp_queue_id=queue_id;
+	addr.sxdp_flags=native_mode ? XDP_ZEROCOPY : XDP_COPY;
+	int ret=bind(f_socket, (struct sockaddr *)&addr, sizeof(addr));
+	if (ret != 0 && native_mode) {
+	  //Not every driver can do zero-copy
+	  addr.sxdp_flags=XDP_COPY;
+	  ret=bind(f_socket, (struct sockaddr *)&addr, sizeof(addr));
+	}
+	if (ret != 0) {
+	  error="could not bind AF_XDP socket to \""+ifname+"\"";
+	}
+      }
+    }
+  }
+  if (error.empty()) {
+    try {
+      loadProgram(ifindex, port, queue_id, native_mode);
+    } catch (xdp_socket_runtime_error &e) {
+      cleanup();
+      throw;
+    }
+  } else {
+    error+=": "+std::string(strerror(errno));
+    cleanup();
+    throw xdp_socket_runtime_error(error);
+  }
+};
+
+XdpSocket::~XdpSocket() {
+  cleanup();
+};
+
+void XdpSocket::cleanup() {
+  //Closing the link detaches the program from the interface
+  if (link_fd >= 0) close(link_fd);
+  if (prog_fd >= 0) close(prog_fd);
+  if (map_fd >= 0) close(map_fd);
+  if (rx_map!=MAP_FAILED) munmap(rx_map, rx_map_size);
+  if (fill_map!=MAP_FAILED) munmap(fill_map, fill_map_size);
+  if (comp_map!=MAP_FAILED) munmap(comp_map, comp_map_size);
+  if (f_socket >= 0) close(f_socket);
+  if (umem!=MAP_FAILED) munmap(umem, umem_size);
+  link_fd=prog_fd=map_fd=f_socket=-1;
+  rx_map=fill_map=comp_map=MAP_FAILED;
+  umem=(char *)MAP_FAILED;
+};
+
+/*
+  Creates the XSKMAP holding our socket, loads the XDP program and attaches it to the interface. The program is equivalent to:
+    if (frame is IPv4 with a 20 byte header && not a fragment && UDP && dest port==port)
+      return bpf_redirect_map(xsks, rx_queue_index, XDP_PASS);
+    return XDP_PASS;
+  Frames arriving on other RX queues fall back to XDP_PASS, since only queue_id has a socket in the map.
+*/
+void XdpSocket::loadProgram(int ifindex, int port, int queue_id, bool native_mode) {
+  union bpf_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.map_type=BPF_MAP_TYPE_XSKMAP;
+  attr.key_size=sizeof(uint32_t);
+  attr.value_size=sizeof(uint32_t);
+  attr.max_entries=queue_id+1;
+  map_fd=bpfSyscall(BPF_MAP_CREATE, &attr);
+  if (map_fd < 0) {
+    throw xdp_socket_runtime_error("could not create XSKMAP (requires CAP_BPF): "+std::string(strerror(errno)));
+  }
+  uint32_t key=queue_id;
+  uint32_t value=f_socket;
+  memset(&attr, 0, sizeof(attr));
+  attr.map_fd=map_fd;
+  attr.key=(uint64_t)&key;
+  attr.value=(uint64_t)&value;
+  if (bpfSyscall(BPF_MAP_UPDATE_ELEM, &attr) != 0) {
+    throw xdp_socket_runtime_error("could not add socket to XSKMAP: "+std::string(strerror(errno)));
+  }
+
+  //Loads see the frame bytes in host (little endian) order
+  const int pass=24;
+  std::vector<struct bpf_insn> prog;
+  prog.push_back(bpfInsn(BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_6, BPF_REG_1, 0, 0));
+  prog.push_back(bpfInsn(BPF_LDX | BPF_W | BPF_MEM, BPF_REG_2, BPF_REG_1, offsetof(struct xdp_md, data), 0));
+  prog.push_back(bpfInsn(BPF_LDX | BPF_W | BPF_MEM, BPF_REG_3, BPF_REG_1, offsetof(struct xdp_md, data_end), 0));
+  prog.push_back(bpfInsn(BPF_ALU64 | BPF_MOV | BPF_X, BPF_REG_4, BPF_REG_2, 0, 0));
+  prog.push_back(bpfInsn(BPF_ALU64 | BPF_ADD | BPF_K, BPF_REG_4, 0, 0, XDP_PAYLOAD_OFFSET));
+  prog.push_back(bpfInsn(BPF_JMP | BPF_JGT | BPF_X, BPF_REG_4, BPF_REG_3, pass-6, 0));
+  //Ether type IPv4
+  prog.push_back(bpfInsn(BPF_LDX | BPF_H | BPF_MEM, BPF_REG_5, BPF_REG_2, 12, 0));
+  prog.push_back(bpfInsn(BPF_JMP | BPF_JNE | BPF_K, BPF_REG_5, 0, pass-8, htons(0x0800)));
+  //Version 4, 20 byte header
+  prog.push_back(bpfInsn(BPF_LDX | BPF_B | BPF_MEM, BPF_REG_5, BPF_REG_2, XDP_IP_OFFSET, 0));
+  prog.push_back(bpfInsn(BPF_JMP | BPF_JNE | BPF_K, BPF_REG_5, 0, pass-10, 0x45));
+  //UDP
+  prog.push_back(bpfInsn(BPF_LDX | BPF_B | BPF_MEM, BPF_REG_5, BPF_REG_2, XDP_IP_OFFSET+9, 0));
+  prog.push_back(bpfInsn(BPF_JMP | BPF_JNE | BPF_K, BPF_REG_5, 0, pass-12, IPPROTO_UDP));
+  //Not a fragment (MF flag or fragment offset set)
+  prog.push_back(bpfInsn(BPF_LDX | BPF_H | BPF_MEM, BPF_REG_5, BPF_REG_2, XDP_IP_OFFSET+6, 0));
+  prog.push_back(bpfInsn(BPF_ALU64 | BPF_AND | BPF_K, BPF_REG_5, 0, 0, htons(0x3FFF)));
+  prog.push_back(bpfInsn(BPF_JMP | BPF_JNE | BPF_K, BPF_REG_5, 0, pass-15, 0));
+  //Destination port
+  prog.push_back(bpfInsn(BPF_LDX | BPF_H | BPF_MEM, BPF_REG_5, BPF_REG_2, XDP_UDP_OFFSET+2, 0));
+  prog.push_back(bpfInsn(BPF_ALU | BPF_END | BPF_TO_BE, BPF_REG_5, 0, 0, 16));
+  prog.push_back(bpfInsn(BPF_JMP | BPF_JNE | BPF_K, BPF_REG_5, 0, pass-18, port));
+  //return bpf_redirect_map(xsks, ctx->rx_queue_index, XDP_PASS)
+  prog.push_back(bpfInsn(BPF_LDX | BPF_W | BPF_MEM, BPF_REG_2, BPF_REG_6, offsetof(struct xdp_md, rx_queue_index), 0));
+  prog.push_back(bpfInsn(BPF_LD | BPF_DW | BPF_IMM, BPF_REG_1, BPF_PSEUDO_MAP_FD, 0, map_fd));
+  prog.push_back(bpfInsn(0, 0, 0, 0, 0));
+  prog.push_back(bpfInsn(BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_3, 0, 0, XDP_PASS));
+  prog.push_back(bpfInsn(BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map));
+  prog.push_back(bpfInsn(BPF_JMP | BPF_EXIT, 0, 0, 0, 0));
+  //pass: return XDP_PASS
+  prog.push_back(bpfInsn(BPF_ALU64 | BPF_MOV | BPF_K, BPF_REG_0, 0, 0, XDP_PASS));
+  prog.push_back(bpfInsn(BPF_JMP | BPF_EXIT, 0, 0, 0, 0));
+
+  char log[4096];
+  log[0]='\0';
+  memset(&attr, 0, sizeof(attr));
+  attr.prog_type=BPF_PROG_TYPE_XDP;
+  attr.insns=(uint64_t)&prog[0];
+  attr.insn_cnt=prog.size();
+  attr.license=(uint64_t)"GPL";
+  attr.log_buf=(uint64_t)log;
+  attr.log_size=sizeof(log);
+  attr.log_level=1;
+  attr.expected_attach_type=BPF_XDP;
+  prog_fd=bpfSyscall(BPF_PROG_LOAD, &attr);
+  if (prog_fd < 0) {
+    throw xdp_socket_runtime_error("could not load XDP program: "+std::string(strerror(errno))+"\n"+log);
+  }
+  memset(&attr, 0, sizeof(attr));
+  attr.link_create.prog_fd=prog_fd;
+  attr.link_create.target_ifindex=ifindex;
+  attr.link_create.attach_type=BPF_XDP;
+  attr.link_create.flags=native_mode ? XDP_FLAGS_DRV_MODE : XDP_FLAGS_SKB_MODE;
+  link_fd=bpfSyscall(BPF_LINK_CREATE, &attr);
+  if (link_fd < 0) {
+    throw xdp_socket_runtime_error("could not attach XDP program (is another one attached?): "+std::string(strerror(errno)));
+  }
+};
+
+int XdpSocket::waitFrames(int timeout_ms, int max) {
+  uint32_t navail=__atomic_load_n(rx_producer, __ATOMIC_ACQUIRE)-rx_cached_consumer;
+  if (navail==0) {
+    struct pollfd pfd;
+    pfd.fd=f_socket;
+    pfd.events=POLLIN;
+    pfd.revents=0;
+    poll(&pfd, 1, timeout_ms);
+    navail=__atomic_load_n(rx_producer, __ATOMIC_ACQUIRE)-rx_cached_consumer;
+  }
+  return (int)navail < max ? (int)navail : max;
+};
+
+char* XdpSocket::frameData(int i, int *len) {
+  struct xdp_desc *desc=&rx_descs[(rx_cached_consumer+i) & (nframes-1)];
+  char *frame=umem+desc->addr;
+  *len=0;
+  if (desc->len < XDP_PAYLOAD_OFFSET) {
+    return frame;
+  }
+  //The program only lets through UDP frames, so trust the UDP length over the frame length (which may include padding)
+  int udp_len=ntohs(*(uint16_t *)(frame+XDP_UDP_OFFSET+4))-8;
+  int frame_payload=desc->len-XDP_PAYLOAD_OFFSET;
+  *len=(udp_len < frame_payload ? udp_len : frame_payload) & ~3;
+  return frame+XDP_PAYLOAD_OFFSET;
+};
+
+void XdpSocket::consumed(int n) {
+  rx_cached_consumer+=n;
+  __atomic_store_n(rx_consumer, rx_cached_consumer, __ATOMIC_RELEASE);
+};
+
+void XdpSocket::releaseFrame(void *ctx, char *data) {
+  XdpSocket *sock=(XdpSocket *)ctx;
+  //The kernel only needs an address inside the frame, it aligns it to the frame start
+  uint64_t addr=(uint64_t)(data-sock->umem) & ~(uint64_t)(XDP_FRAME_SIZE-1);
+  //There are as many fill ring entries as frames, so this never overflows
+  sock->fill_addrs[sock->fill_cached_producer & (sock->nframes-1)]=addr;
+  sock->fill_cached_producer++;
+  __atomic_store_n(sock->fill_producer, sock->fill_cached_producer, __ATOMIC_RELEASE);
+};
+
+int XdpSocket::getDropCount() {
+  struct xdp_statistics stats;
+  socklen_t len=sizeof(stats);
+  if (getsockopt(f_socket, SOL_XDP, XDP_STATISTICS, &stats, &len) != 0) {
+    return 0;
+  }
+  return stats.rx_dropped+stats.rx_ring_full;
+};
@@ -18,6 +18,22 @@
 #include "udp_client_server.h"
 #include <string.h>
 #include <unistd.h>
+#include <sched.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/select.h>
+#include <linux/sock_diag.h>
+#include <linux/net_tstamp.h>
+#include <linux/filter.h>
+#include <arpa/inet.h>
+
+// SO_PREFER_BUSY_POLL arrived in Linux 5.11, older headers lack it
+#ifndef SO_PREFER_BUSY_POLL
+#define SO_PREFER_BUSY_POLL 69
+#endif
+
+// Number of non-blocking receive attempts before a busy-poll wait starts yielding the CPU
+#define BUSY_POLL_SPIN_COUNT 1000
 
 
 void printHex(int nbytes, char *buffer) {
@@ -67,6 +83,7 @@ namespace udp_client_server
 	udp_client::udp_client(const std::string& addr, int port)
     : f_port(port)
     , f_addr(addr)
+    , f_connected(false)
 	{
     char decimal_port[16];
     snprintf(decimal_port, sizeof(decimal_port), "%d", f_port);
@@ -158,9 +175,110 @@ namespace udp_client_server
 	 */
 	int udp_client::send(const char *msg, size_t size)
 	{
+    if(f_connected)
+			{
+        return ::send(f_socket, msg, size, 0);
+			}
     return sendto(f_socket, msg, size, 0, f_addrinfo->ai_addr, f_addrinfo->ai_addrlen);
 	};
 
+	/** \brief Connect the client socket to its destination.
+	 *
+	 * This function connect()s the socket to the address and port given to
+	 * the constructor, so the kernel resolves the route once instead of on
+	 * every send(), and send() passes no address.
+	 *
+	 * \note
+	 * Once connected, an ICMP port unreachable reply to an earlier datagram
+	 * makes the next send() fail with ECONNREFUSED (without sending), which
+	 * an unconnected socket never reports.
+	 *
+	 * \return 0 on success, -1 if the socket could not be connected (errno
+	 * is set accordingly, and send() keeps using sendto()).
+	 */
+	int udp_client::connect()
+	{
+    int r(::connect(f_socket, f_addrinfo->ai_addr, f_addrinfo->ai_addrlen));
+    if(r == 0)
+			{
+        f_connected = true;
+			}
+    return r;
+	}
+
+	/** \brief Send a batch of messages with a single system call.
+	 *
+	 * This function sends the datagrams described by \p msgs with one
+	 * sendmmsg() call. The destination is filled in here when the socket
+	 * is not connected. The number of bytes sent for each datagram is
+	 * returned in the msg_len field of its mmsghdr.
+	 *
+	 * If an error occurs after the first datagram, the function returns the
+	 * number of datagrams sent before it. Calling it again for the remaining
+	 * datagrams reports the error.
+	 *
+	 * \param[in] msgs  Array of messages to send.
+	 * \param[in] vlen  The number of entries in \p msgs (at most UIO_MAXIOV).
+	 *
+	 * \return -1 if the first datagram could not be sent (errno is set
+	 * accordingly), the number of datagrams sent otherwise.
+	 */
+	int udp_client::send_batch(struct mmsghdr *msgs, unsigned int vlen)
+	{
+    if(!f_connected)
+			{
+        for(unsigned int i(0); i < vlen; ++i)
+					{
+            msgs[i].msg_hdr.msg_name = f_addrinfo->ai_addr;
+            msgs[i].msg_hdr.msg_namelen = f_addrinfo->ai_addrlen;
+					}
+			}
+    return sendmmsg(f_socket, msgs, vlen, 0);
+	}
+
+	/** \brief Send a buffer as a train of equally sized datagrams.
+	 *
+	 * This function hands the whole buffer to the kernel with a UDP_SEGMENT
+	 * control message. The kernel (or the NIC, with segmentation offload)
+	 * splits it into datagrams of \p segment_size bytes. The last datagram
+	 * carries what is left. The buffer must fit in a single IP packet
+	 * (65507 bytes over IPv4) and hold at most 64 segments.
+	 *
+	 * \param[in] msg  The data to send.
+	 * \param[in] size  The number of bytes in \p msg.
+	 * \param[in] segment_size  The payload size of each datagram.
+	 *
+	 * \return -1 if an error occurs (errno is set accordingly; EIO or
+	 * EINVAL if the kernel or route can't segment), otherwise the number of
+	 * bytes sent. All the datagrams go out or none do.
+	 */
+	int udp_client::send_segmented(const char *msg, size_t size, int segment_size)
+	{
+    struct iovec iov;
+    iov.iov_base = const_cast<char *>(msg);
+    iov.iov_len = size;
+    char control[CMSG_SPACE(sizeof(uint16_t))];
+    memset(control, 0, sizeof(control));
+    struct msghdr hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    if(!f_connected)
+			{
+        hdr.msg_name = f_addrinfo->ai_addr;
+        hdr.msg_namelen = f_addrinfo->ai_addrlen;
+			}
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = control;
+    hdr.msg_controllen = sizeof(control);
+    struct cmsghdr *cmsg(CMSG_FIRSTHDR(&hdr));
+    cmsg->cmsg_level = SOL_UDP;
+    cmsg->cmsg_type = UDP_SEGMENT;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+    uint16_t gso_size(segment_size);
+    memcpy(CMSG_DATA(cmsg), &gso_size, sizeof(gso_size));
+    return sendmsg(f_socket, &hdr, 0);
+	}
+
 	/*Wrapper for std::vector of uint32s */
 	
 	int udp_client::send(std::vector<uint32_t> data)
@@ -207,6 +325,8 @@ namespace udp_client_server
 	udp_server::udp_server(const std::string& addr, int port)
     : f_port(port)
     , f_addr(addr)
+    , f_busy_poll(false)
+    , f_truncated(0)
 	{
     char decimal_port[16];
     snprintf(decimal_port, sizeof(decimal_port), "%d", f_port);
@@ -230,8 +350,11 @@ namespace udp_client_server
     r = bind(f_socket, f_addrinfo->ai_addr, f_addrinfo->ai_addrlen);
     if(r != 0)
 			{
+        //Keep errno for the caller (e.g. EADDRINUSE while another socket holds the port)
+        int bind_errno = errno;
         freeaddrinfo(f_addrinfo);
         close(f_socket);
+        errno = bind_errno;
         throw udp_client_server_runtime_error(("could not bind UDP socket with: \"" + addr + ":" + decimal_port + "\"").c_str());
 			}
 	}
@@ -303,7 +426,45 @@ namespace udp_client_server
 	 */
 	int udp_server::recv(char *msg, size_t max_size)
 	{
-    return ::recv(f_socket, msg, max_size, 0);
+    return recv_checked(msg, max_size, 0);
+	}
+
+	/** \brief Receive one datagram, noting whether it was cut short.
+	 *
+	 * This function asks recv() for the full length of the datagram
+	 * (MSG_TRUNC), so a datagram larger than \p msg is counted as truncated
+	 * (see get_truncated_count()). The return value is still capped at
+	 * \p max_size.
+	 *
+	 * \param[in] msg  The buffer where the message is saved.
+	 * \param[in] max_size  The size of the \p msg buffer in bytes.
+	 * \param[in] flags  Flags passed on to recv().
+	 *
+	 * \return The number of bytes read or -1 if an error occurs.
+	 */
+	int udp_server::recv_checked(char *msg, size_t max_size, int flags)
+	{
+    int r(::recv(f_socket, msg, max_size, flags | MSG_TRUNC));
+    if(r > static_cast<int>(max_size))
+			{
+        ++f_truncated;
+        r = max_size;
+			}
+    return r;
+	}
+
+	/** \brief Retrieve the number of datagrams cut short so far.
+	 *
+	 * This function returns how many of the datagrams received with recv()
+	 * and timed_recv() were larger than the buffer they were received into,
+	 * and lost their tail. (recvmmsg() reports this per datagram, with
+	 * MSG_TRUNC in msg_flags.)
+	 *
+	 * \return The number of truncated datagrams.
+	 */
+	int udp_server::get_truncated_count() const
+	{
+    return f_truncated;
 	}
 
 	/** \brief Wait for data to come in.
@@ -327,13 +488,24 @@ namespace udp_client_server
 	 */
 	int udp_server::timed_recv(char *msg, size_t max_size, int max_wait_ms)
 	{
+    if(f_busy_poll)
+			{
+        busy_wait_t wait(max_wait_ms);
+        int r;
+        while((r = recv_checked(msg, max_size, MSG_DONTWAIT)) < 0 && wait.again())
+			{
+			}
+        return r;
+			}
     fd_set s;
     FD_ZERO(&s);
     FD_SET(f_socket, &s);
     struct timeval timeout;
     timeout.tv_sec = max_wait_ms / 1000;
     timeout.tv_usec = (max_wait_ms % 1000) * 1000;
-    int retval = select(f_socket + 1, &s, &s, &s, &timeout);
+    // only wait for readability: the socket is always writable, so also
+    // waiting on that would return at once without any data
+    int retval = select(f_socket + 1, &s, NULL, NULL, &timeout);
     if(retval == -1)
 			{
         // select() set errno accordingly
@@ -342,7 +514,7 @@ namespace udp_client_server
     if(retval > 0)
 			{
         // our socket has data
-        return ::recv(f_socket, msg, max_size, MSG_DONTWAIT);
+        return recv_checked(msg, max_size, MSG_DONTWAIT);
 			}
 
     // our socket has no data
@@ -350,4 +522,309 @@ namespace udp_client_server
     return -1;
 	}
 
+	/** \brief Wait for a batch of messages to come in.
+	 *
+	 * This function waits up to max_wait_ms for the socket to become
+	 * readable and then drains as many queued datagrams as are available,
+	 * up to \p vlen, with a single recvmmsg() call. The length of each
+	 * datagram is returned in the msg_len field of its mmsghdr.
+	 *
+	 * The caller owns the \p msgs array and the buffers its iovecs point
+	 * to, so the same array can be reused for every call.
+	 *
+	 * \param[in] msgs  Array of message headers to fill.
+	 * \param[in] vlen  The number of entries in \p msgs.
+	 * \param[in] max_wait_ms  The maximum number of milliseconds to wait for a message.
+	 *
+	 * \return -1 if an error occurs or the function timed out, the number of datagrams received otherwise.
+	 */
+	int udp_server::timed_recvmmsg(struct mmsghdr *msgs, unsigned int vlen, int max_wait_ms)
+	{
+    if(f_busy_poll)
+			{
+        busy_wait_t wait(max_wait_ms);
+        int r;
+        while((r = ::recvmmsg(f_socket, msgs, vlen, MSG_DONTWAIT, NULL)) < 0 && wait.again())
+			{
+			}
+        return r;
+			}
+    fd_set s;
+    FD_ZERO(&s);
+    FD_SET(f_socket, &s);
+    struct timeval timeout;
+    timeout.tv_sec = max_wait_ms / 1000;
+    timeout.tv_usec = (max_wait_ms % 1000) * 1000;
+    int retval = select(f_socket + 1, &s, NULL, NULL, &timeout);
+    if(retval == -1)
+			{
+        // select() set errno accordingly
+        return -1;
+			}
+    if(retval > 0)
+			{
+        // our socket has data, take everything that is queued
+        return ::recvmmsg(f_socket, msgs, vlen, MSG_DONTWAIT, NULL);
+			}
+
+    // our socket has no data
+    errno = EAGAIN;
+    return -1;
+	}
+
+	/** \brief Set the size of the kernel receive buffer.
+	 *
+	 * This function requests a kernel receive buffer of \p size bytes with
+	 * SO_RCVBUF. The kernel silently caps SO_RCVBUF at net.core.rmem_max, so
+	 * if the resulting buffer is smaller than requested the function tries
+	 * again with SO_RCVBUFFORCE, which ignores the cap but requires
+	 * CAP_NET_ADMIN. If neither works the capped buffer is kept.
+	 *
+	 * \param[in] size  The requested buffer size in bytes.
+	 *
+	 * \return The buffer size reported by the kernel (see get_rcvbuf()), or -1 on error.
+	 */
+	int udp_server::set_rcvbuf(int size)
+	{
+    if(setsockopt(f_socket, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size)) != 0)
+			{
+        return -1;
+			}
+    // the kernel doubles the value to account for bookkeeping overhead
+    if(get_rcvbuf() < 2 * size)
+			{
+        setsockopt(f_socket, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size));
+			}
+    return get_rcvbuf();
+	}
+
+	/** \brief Retrieve the size of the kernel receive buffer.
+	 *
+	 * Note that the kernel reports twice the size that was requested, since
+	 * the buffer also holds the per-datagram bookkeeping.
+	 *
+	 * \return The receive buffer size in bytes, or -1 on error.
+	 */
+	int udp_server::get_rcvbuf() const
+	{
+    int size(0);
+    socklen_t len(sizeof(size));
+    if(getsockopt(f_socket, SOL_SOCKET, SO_RCVBUF, &size, &len) != 0)
+			{
+        return -1;
+			}
+    return size;
+	}
+
+	/** \brief Ask the kernel to report dropped datagrams.
+	 *
+	 * This function enables SO_RXQ_OVFL on the socket. Once enabled, each
+	 * datagram received with recvmsg() or recvmmsg() carries a control
+	 * message with the number of datagrams the kernel dropped on this
+	 * socket so far (as a uint32_t), provided the caller passes a control
+	 * buffer.
+	 *
+	 * \return 0 on success, -1 on error.
+	 */
+	int udp_server::enable_drop_count()
+	{
+    int on(1);
+    return setsockopt(f_socket, SOL_SOCKET, SO_RXQ_OVFL, &on, sizeof(on));
+	}
+
+	/** \brief Retrieve the number of datagrams dropped by the kernel.
+	 *
+	 * The SO_RXQ_OVFL counter is only delivered alongside a datagram, so
+	 * drops after the last datagram received are not seen there. This
+	 * function reads the same counter directly with SO_MEMINFO, which
+	 * makes it usable once a transfer has finished.
+	 *
+	 * \return The number of datagrams dropped on this socket, or -1 on error.
+	 */
+	int udp_server::get_drop_count() const
+	{
+    uint32_t meminfo[SK_MEMINFO_VARS];
+    socklen_t len(sizeof(meminfo));
+    memset(meminfo, 0, sizeof(meminfo));
+    if(getsockopt(f_socket, SOL_SOCKET, SO_MEMINFO, meminfo, &len) != 0)
+			{
+        return -1;
+			}
+    return meminfo[SK_MEMINFO_DROPS];
+	}
+
+	/** \brief Switch the socket to busy polling.
+	 *
+	 * This function sets SO_BUSY_POLL, so that each receive call polls
+	 * the device queue for up to \p usecs microseconds instead of waiting
+	 * for an interrupt, and SO_PREFER_BUSY_POLL, so that the driver keeps
+	 * its interrupts masked while we poll. From then on timed_recv() and
+	 * timed_recvmmsg() spin on non-blocking receives (yielding the CPU
+	 * after a while) instead of sleeping in select(), which removes the
+	 * wakeup latency at the cost of a busy CPU while waiting.
+	 *
+	 * Raising SO_BUSY_POLL above net.core.busy_read needs CAP_NET_ADMIN,
+	 * and not every driver supports busy polling. The spinning receive is
+	 * used even if the kernel refuses both options.
+	 *
+	 * \param[in] usecs  How long each receive call may poll the device, in microseconds.
+	 *
+	 * \return 0 if the kernel accepted SO_BUSY_POLL, -1 otherwise.
+	 */
+	int udp_server::enable_busy_poll(int usecs)
+	{
+    f_busy_poll = true;
+    int on(1);
+    setsockopt(f_socket, SOL_SOCKET, SO_PREFER_BUSY_POLL, &on, sizeof(on));
+    return setsockopt(f_socket, SOL_SOCKET, SO_BUSY_POLL, &usecs, sizeof(usecs));
+	}
+
+	/** \brief Check if the socket is in busy poll mode.
+	 *
+	 * \return true once enable_busy_poll() has been called.
+	 */
+	bool udp_server::is_busy_poll() const
+	{
+    return f_busy_poll;
+	}
+
+	/** \brief Ask the kernel to timestamp received datagrams.
+	 *
+	 * Without \p hardware this function sets SO_TIMESTAMPNS: each datagram
+	 * received with recvmsg() or recvmmsg() then carries an SCM_TIMESTAMPNS
+	 * control message with the time (CLOCK_REALTIME, as a struct timespec)
+	 * at which the kernel received it from the driver.
+	 *
+	 * With \p hardware it sets SO_TIMESTAMPING instead, asking for both the
+	 * software timestamp and the raw timestamp of the NIC clock, delivered
+	 * together in an SCM_TIMESTAMPING control message (three struct
+	 * timespec: software, deprecated, hardware). The hardware timestamp is
+	 * only filled in if receive timestamping was also switched on for the
+	 * device (SIOCSHWTSTAMP, e.g. with hwstamp_ctl), and it counts on the NIC
+	 * clock, which is not synchronised with the system clock unless
+	 * phc2sys runs.
+	 *
+	 * \param[in] hardware  Whether to ask for NIC timestamps as well.
+	 *
+	 * \return 0 on success, -1 on error.
+	 */
+	int udp_server::enable_timestamps(bool hardware)
+	{
+    if(hardware)
+			{
+        int flags(SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE
+                | SOF_TIMESTAMPING_RX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE);
+        return setsockopt(f_socket, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags));
+			}
+    int on(1);
+    return setsockopt(f_socket, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on));
+	}
+
+	/** \brief Let the kernel coalesce received datagrams.
+	 *
+	 * This function sets UDP_GRO on the socket. Consecutive datagrams of
+	 * the same flow and size that arrive together are then handed over as
+	 * one buffer holding their payloads back to back, so the caller must
+	 * receive into buffers of up to 64 KB. Each coalesced buffer comes with
+	 * a UDP_GRO control message (SOL_UDP level) giving the size of the
+	 * datagrams (as an int); all of them have that size except possibly the
+	 * last one. A buffer without the control message holds one datagram.
+	 *
+	 * Whether datagrams actually get coalesced depends on the driver doing
+	 * GRO (see ethtool -k).
+	 *
+	 * \return 0 on success, -1 on error (e.g. kernels before 5.0).
+	 */
+	int udp_server::enable_gro()
+	{
+    int on(1);
+    return setsockopt(f_socket, SOL_UDP, UDP_GRO, &on, sizeof(on));
+	}
+
+	/** \brief Only accept datagrams from one sender.
+	 *
+	 * This function attaches a classic BPF program (SO_ATTACH_FILTER) that
+	 * accepts a datagram only if it comes from the IPv4 address \p src_addr
+	 * and, unless \p src_port is negative, from the UDP port \p src_port.
+	 * Anything else is dropped by the kernel before it is queued, so it
+	 * never wakes up a reader. No privileges are needed.
+	 *
+	 * The kernel counts the datagrams rejected by the filter together with
+	 * those dropped for lack of buffer space, in the counter read by
+	 * get_drop_count() and delivered by enable_drop_count().
+	 *
+	 * \param[in] src_addr  The sender's IPv4 address, in dotted notation.
+	 * \param[in] src_port  The sender's port, or -1 to accept any port.
+	 *
+	 * \return 0 on success, -1 on error (e.g. \p src_addr is not an IPv4
+	 * address).
+	 */
+	int udp_server::attach_filter(const std::string& src_addr, int src_port)
+	{
+    struct in_addr addr;
+    if(inet_pton(AF_INET, src_addr.c_str(), &addr) != 1)
+			{
+        errno = EINVAL;
+        return -1;
+			}
+    // the filter sees the datagram from its UDP header on, the IP header
+    // sits at the SKF_NET_OFF negative offset
+    struct sock_filter code[] = {
+        BPF_STMT(BPF_LD | BPF_W | BPF_ABS, static_cast<uint32_t>(SKF_NET_OFF + 12)),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ntohl(addr.s_addr), 0, 3),
+        BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 0),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, static_cast<uint16_t>(src_port), 0, 1),
+        BPF_STMT(BPF_RET | BPF_K, 0xFFFFFFFF),
+        BPF_STMT(BPF_RET | BPF_K, 0)
+    };
+    struct sock_fprog prog;
+    prog.filter = code;
+    prog.len = sizeof(code) / sizeof(code[0]);
+    if(src_port < 0)
+			{
+        // accept straight after the address check
+        code[2] = BPF_STMT(BPF_RET | BPF_K, 0xFFFFFFFF);
+			}
+    return setsockopt(f_socket, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog));
+	}
+
+	/** \brief Start a busy wait of at most max_wait_ms milliseconds.
+	 */
+	udp_server::busy_wait_t::busy_wait_t(int max_wait_ms)
+    : f_spins(0)
+	{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    f_deadline_ns = now.tv_sec * 1000000000LL + now.tv_nsec + max_wait_ms * 1000000LL;
+	}
+
+	/** \brief Decide whether to try receiving again.
+	 *
+	 * Called after a non-blocking receive failed. Spins at first, then
+	 * yields the CPU between attempts.
+	 *
+	 * \return true if the receive should be retried, false (with errno set
+	 * to EAGAIN) once the deadline has passed, or if the receive failed
+	 * for any other reason than having no data.
+	 */
+	bool udp_server::busy_wait_t::again()
+	{
+    if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+			{
+        return false;
+			}
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if(now.tv_sec * 1000000000LL + now.tv_nsec >= f_deadline_ns)
+			{
+        errno = EAGAIN;
+        return false;
+			}
+    if(++f_spins > BUSY_POLL_SPIN_COUNT)
+			{
+        sched_yield();
+			}
+    return true;
+	}
+
 } // namespace udp_client_server
@@ -0,0 +1,101 @@
+#include "SequenceTracker.hpp"
+#include <iostream>
+#include <string>
+
+#define FRAME_WORDS 100
+
+//Feeds frames to a tracker the way an acquisition thread does, keeping count of the words written
+class Feeder {
+public:
+	Feeder() : words_written(0) {}
+	bool frame(int stream, uint32_t seq) {
+		bool keep=tracker.check((uint32_t(stream) << 24) | (seq & 0xFFFFFF), FRAME_WORDS, words_written);
+		if (keep) words_written+=FRAME_WORDS;
+		return keep;
+	}
+	SequenceTracker tracker;
+	long words_written;
+};
+
+int nfailed=0;
+
+void expect(bool ok, std::string what) {
+	if (!ok) {
+		std::cout << "FAIL: " << what << std::endl;
+		nfailed++;
+	}
+}
+
+int main () {
+	{
+		//The 24-bit counter wraps from 0xFFFFFF to 0 without a gap
+		Feeder f;
+		bool kept=true;
+		for (uint32_t seq=0xFFFFFD; seq != 0x000002; seq=(seq+1) & 0xFFFFFF) {
+			kept=f.frame(0, seq) && kept;
+		}
+		seq_stats_t stats=f.tracker.getStats();
+		expect(kept && stats.frames==5 && stats.gaps==0 && f.tracker.getLossMap().empty(), "wrap-around at 0xFFFFFF counted as a gap");
+	}
+	{
+		//A gap across the wrap: 0xFFFFFF, 0 and 1 are missing
+		Feeder f;
+		f.frame(0, 0xFFFFFD);
+		f.frame(0, 0xFFFFFE);
+		f.frame(0, 2);
+		seq_stats_t stats=f.tracker.getStats();
+		const std::vector<loss_range_t> &losses=f.tracker.getLossMap();
+		expect(stats.gaps==1 && stats.missing_frames==3 && losses.size()==1, "gap across the wrap not counted as 3 frames");
+		if (losses.size()==1) {
+			expect(losses[0].first_seq==0xFFFFFF && losses[0].nframes==3, "gap across the wrap starts at the wrong frame");
+			//The gap sits after the two frames written before it
+			expect(losses[0].word_offset==2*FRAME_WORDS && losses[0].nwords==3*FRAME_WORDS, "gap across the wrap at the wrong place in the output");
+		}
+	}
+	{
+		//A repeated frame is dropped as a duplicate
+		Feeder f;
+		f.frame(0, 5);
+		f.frame(0, 6);
+		bool kept=f.frame(0, 6);
+		f.frame(0, 7);
+		seq_stats_t stats=f.tracker.getStats();
+		expect(!kept && stats.duplicates==1 && stats.frames==3 && stats.gaps==0, "duplicate frame kept or miscounted");
+		expect(f.words_written==3*FRAME_WORDS, "duplicate frame written");
+	}
+	{
+		//Frames arriving after a later one fall in the gap: counted as reordered, not written, and the loss map keeps the gap
+		Feeder f;
+		f.frame(0, 10);
+		f.frame(0, 13);
+		bool kept11=f.frame(0, 11);
+		bool kept12=f.frame(0, 12);
+		f.frame(0, 14);
+		seq_stats_t stats=f.tracker.getStats();
+		expect(!kept11 && !kept12 && stats.reorders==2 && stats.duplicates==0, "reordered frames kept or taken for duplicates");
+		expect(stats.gaps==1 && stats.missing_frames==2 && f.tracker.getLossMap().size()==1, "reordered frames changed the loss map");
+		expect(f.words_written==3*FRAME_WORDS, "reordered frames written");
+		//A frame older than the gap is a duplicate
+		expect(!f.frame(0, 9) && f.tracker.getStats().duplicates==1, "frame before the gap not taken for a duplicate");
+	}
+	{
+		//Streams are tracked apart, each from its own first count
+		Feeder f;
+		for (uint32_t i=0; i < 4; i++) {
+			f.frame(1, 0x123456+i);
+			f.frame(2, 0xFFFFFE + i);
+		}
+		f.frame(1, 0x123456+6);
+		seq_stats_t stats=f.tracker.getStats();
+		const std::vector<loss_range_t> &losses=f.tracker.getLossMap();
+		expect(stats.frames==9 && stats.gaps==1 && stats.missing_frames==2, "interleaved streams miscounted");
+		if (losses.size()==1) {
+			expect(losses[0].stream==1 && losses[0].first_seq==0x12345A && losses[0].word_offset==8*FRAME_WORDS, "gap of an interleaved stream recorded wrong");
+		}
+	}
+	if (nfailed > 0) {
+		return 1;
+	}
+	std::cout << "PASS" << std::endl;
+	return 0;
+}
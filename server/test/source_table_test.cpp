@@ -0,0 +1,46 @@
+#include "SourceTable.hpp"
+#include <iostream>
+#include <set>
+#include <string>
+#include <arpa/inet.h>
+
+//Address in network byte order, as the receive loop gets it from the kernel
+uint32_t address(std::string dotted) {
+	struct in_addr addr;
+	inet_pton(AF_INET, dotted.c_str(), &addr);
+	return addr.s_addr;
+}
+
+int main () {
+	int nfailed=0;
+	//Boards on one /24 differ in the last octet only, which must still spread them over the table
+	for (int nboards=2; nboards <= 64; nboards*=2) {
+		SourceTable table(nboards);
+		std::set<uint32_t> slots;
+		for (int i=0; i < nboards; i++) {
+			uint32_t addr=address("192.168.1."+std::to_string(i+1));
+			slots.insert(table.slot(addr));
+			table.add(addr, i);
+		}
+		if (int(slots.size()) != nboards) {
+			std::cout << "FAIL: " << nboards << " boards on one /24 share " << nboards-slots.size() << " home slots." << std::endl;
+			nfailed++;
+		}
+		for (int i=0; i < nboards; i++) {
+			int index=table.find(address("192.168.1."+std::to_string(i+1)));
+			if (index != i) {
+				std::cout << "FAIL: board " << i << " of " << nboards << " found as " << index << "." << std::endl;
+				nfailed++;
+			}
+		}
+		if (table.find(address("192.168.1.200")) != -1 || table.find(address("10.0.0.1")) != -1) {
+			std::cout << "FAIL: a stray address was found in a table of " << nboards << " boards." << std::endl;
+			nfailed++;
+		}
+	}
+	if (nfailed > 0) {
+		return 1;
+	}
+	std::cout << "PASS" << std::endl;
+	return 0;
+}
@@ -0,0 +1,128 @@
+#include "StreamMerger.hpp"
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <cstring>
+#include <unistd.h>
+
+//Publishes a one-word frame with the given sequence number on a merger input, as a receive thread does
+void push(PacketRing *ring, uint32_t seq, uint32_t word) {
+	ring->waitFree();
+	packet_slot_t &slot=ring->producerSlot(0);
+	slot.data=ring->producerBuffer(0);
+	memcpy(slot.data, &word, 4);
+	slot.len=4;
+	slot.app_header=seq & 0xFFFFFF;
+	ring->publish(1);
+}
+
+//Runs the merger over inputs filled and closed beforehand, and returns the words it wrote
+std::vector<uint32_t> merge(StreamMerger &merger) {
+	std::string fname="/tmp/stream_merger_test_"+std::to_string(getpid())+".bin";
+	DataWriter writer;
+	writer.open(fname, 0, 0);
+	merger.run(writer);
+	writer.close();
+	std::vector<uint32_t> words;
+	std::ifstream infile(fname, std::ios::binary);
+	uint32_t word;
+	while (infile.read((char *)&word, 4)) {
+		words.push_back(word);
+	}
+	unlink(fname.c_str());
+	return words;
+}
+
+std::string describe(const std::vector<uint32_t> &words) {
+	std::string s;
+	for (unsigned int i=0; i < words.size(); i++) {
+		s+=" "+std::to_string(words[i]);
+	}
+	return s;
+}
+
+int nfailed=0;
+
+void expect(bool ok, std::string what) {
+	if (!ok) {
+		std::cout << "FAIL: " << what << std::endl;
+		nfailed++;
+	}
+}
+
+int main () {
+	{
+		//Counters that don't start together (one about to wrap) are each aligned on their first frame, and the inputs take turns
+		StreamMerger merger(100);
+		PacketRing *a=merger.addInput(16, 64);
+		PacketRing *b=merger.addInput(16, 64);
+		for (uint32_t i=0; i < 4; i++) {
+			push(a, 100+i, 10+i);
+			push(b, 0xFFFFFE + i, 20+i);
+		}
+		a->close();
+		b->close();
+		std::vector<uint32_t> words=merge(merger);
+		uint32_t expected[]={10, 20, 11, 21, 12, 22, 13, 23};
+		expect(words==std::vector<uint32_t>(expected, expected+8), "inputs starting apart merged as"+describe(words));
+		merge_stats_t stats=merger.getStats();
+		expect(stats.frames==8 && stats.words==8 && stats.lost==0 && stats.late==0, "inputs starting apart miscounted");
+	}
+	{
+		//A frame missing from one input is skipped once its next frame is there, without holding up the other input
+		StreamMerger merger(100);
+		PacketRing *a=merger.addInput(16, 64);
+		PacketRing *b=merger.addInput(16, 64);
+		for (uint32_t i=0; i < 4; i++) {
+			push(a, 7+i, 10+i);
+			if (i != 1) push(b, 500+i, 20+i);
+		}
+		a->close();
+		b->close();
+		std::vector<uint32_t> words=merge(merger);
+		uint32_t expected[]={10, 20, 11, 12, 22, 13, 23};
+		expect(words==std::vector<uint32_t>(expected, expected+7), "input with a lost frame merged as"+describe(words));
+		merge_stats_t stats=merger.getStats();
+		expect(stats.frames==7 && stats.lost==1 && stats.late==0, "lost frame miscounted");
+	}
+	{
+		//A frame for a turn already taken is dropped as late
+		StreamMerger merger(100);
+		PacketRing *a=merger.addInput(16, 64);
+		PacketRing *b=merger.addInput(16, 64);
+		push(a, 0, 10);
+		push(a, 1, 11);
+		push(a, 2, 12);
+		push(b, 40, 20);
+		push(b, 41, 21);
+		push(b, 40, 99);
+		push(b, 42, 22);
+		a->close();
+		b->close();
+		std::vector<uint32_t> words=merge(merger);
+		uint32_t expected[]={10, 20, 11, 21, 12, 22};
+		expect(words==std::vector<uint32_t>(expected, expected+6), "input with an old frame merged as"+describe(words));
+		merge_stats_t stats=merger.getStats();
+		expect(stats.frames==6 && stats.lost==0 && stats.late==1, "late frame miscounted");
+	}
+	{
+		//An input that closes early leaves the others running
+		StreamMerger merger(100);
+		PacketRing *a=merger.addInput(16, 64);
+		PacketRing *b=merger.addInput(16, 64);
+		push(a, 3, 10);
+		push(b, 9, 20);
+		push(b, 10, 21);
+		push(b, 11, 22);
+		a->close();
+		b->close();
+		std::vector<uint32_t> words=merge(merger);
+		uint32_t expected[]={10, 20, 21, 22};
+		expect(words==std::vector<uint32_t>(expected, expected+4), "inputs closing apart merged as"+describe(words));
+	}
+	if (nfailed > 0) {
+		return 1;
+	}
+	std::cout << "PASS" << std::endl;
+	return 0;
+}